@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <string.h>
+#include <list>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "brickstore.hpp"
+#include "parallel.hpp"
+
+namespace brickstore{
+
+	struct Header{
+		char magic[8];   // "BRICKS1"
+		int size;
+		int brick;
+		int pages;       // bricks per side
+		int reserved;
+	};
+
+	// bricks start on a page boundary after the header and the maxima
+	#define BRICKSTORE_ALIGNMENT 4096
+
+	typedef std::vector<unsigned char> Voxels;
+
+	struct Entry{
+		std::shared_ptr<Voxels> voxels;
+		std::list<int>::iterator lru;
+		unsigned int generation;   // last prefetch pass or read that wanted it
+		bool prefetched;           // read ahead, not asked for yet
+	};
+
+	static int file = -1;
+	static Header header;
+	static std::vector<unsigned char> maxima;   // largest voxel of every brick
+	static off_t dataOffset = 0;
+	static size_t recordSize = 0;
+	static Stats counters;
+
+	static std::mutex mutex;
+	static std::condition_variable loaded;      // a brick left the loading set
+	static std::condition_variable wake;        // prefetch work, or shutdown
+	static std::unordered_map<int, Entry> cache;
+	static std::list<int> lru;                  // most recently used first
+	static std::unordered_set<int> loading;     // being read, by anyone
+	static std::deque<int> prefetchQueue;
+	static std::vector<std::thread> prefetchers;
+	static unsigned int generation = 0;
+	static bool stopping = false;
+
+	static bool readAll(int fd, void * data, size_t size, off_t offset){
+		char * bytes = (char *)data;
+		while (size > 0){
+			ssize_t done = pread(fd, bytes, size, offset);
+			if (done <= 0) return false;
+			bytes += done; size -= done; offset += done;
+		}
+		return true;
+	}
+
+	static bool writeAll(int fd, const void * data, size_t size, off_t offset){
+		const char * bytes = (const char *)data;
+		while (size > 0){
+			ssize_t done = pwrite(fd, bytes, size, offset);
+			if (done <= 0) return false;
+			bytes += done; size -= done; offset += done;
+		}
+		return true;
+	}
+
+	static off_t recordsOffset(int count){
+		off_t end = sizeof(Header) + count;
+		return (end + BRICKSTORE_ALIGNMENT - 1) / BRICKSTORE_ALIGNMENT * BRICKSTORE_ALIGNMENT;
+	}
+
+	bool write(const std::string & path, int size, int brick, virtualvolume::BrickGenerator generate){
+		int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) return false;
+
+		Header h;
+		memset(&h, 0, sizeof(h));
+		strcpy(h.magic, "BRICKS1");
+		h.size = size;
+		h.brick = brick;
+		h.pages = (size + brick - 1) / brick;
+		int count = h.pages*h.pages*h.pages;
+		int apron = brick + 2;
+		size_t record = (size_t)apron*apron*apron;
+		off_t data = recordsOffset(count);
+
+		std::vector<unsigned char> largest(count);
+		std::atomic<bool> failed(false);
+		parallel_for(0, count, [&](int first, int last){
+			Voxels voxels(record);
+			for (int b = first; b < last && !failed; b++){
+				int x = b / (h.pages*h.pages), y = (b / h.pages) % h.pages, z = b % h.pages;
+				generate(x*brick - 1, y*brick - 1, z*brick - 1, brick, &voxels[0]);
+				largest[b] = *std::max_element(voxels.begin(), voxels.end());
+				// empty bricks stay holes
+				if (largest[b] && !writeAll(fd, &voxels[0], record, data + (off_t)b*record))
+					failed = true;
+			}
+		});
+
+		bool ok = !failed && writeAll(fd, &h, sizeof(h), 0)
+		          && writeAll(fd, &largest[0], count, sizeof(h))
+		          && ftruncate(fd, data + (off_t)count*record) == 0;
+		ok = ::close(fd) == 0 && ok;
+		return ok;
+	}
+
+	// makes room for one more record, least recently used out first. A
+	// prefetch does not push out what the current view wants ; returns
+	// false then.
+	static bool makeRoom(bool ahead){
+		while (!lru.empty() && counters.residentBytes + recordSize > counters.budget){
+			int victim = lru.back();
+			Entry & entry = cache[victim];
+			if (ahead && entry.generation == generation) return false;
+			counters.residentBytes -= entry.voxels->size();
+			counters.evicted++;
+			lru.pop_back();
+			cache.erase(victim);
+		}
+		return counters.residentBytes + recordSize <= counters.budget;
+	}
+
+	// brick b, from the cache or the disk ; lock is held on entry and exit
+	static std::shared_ptr<Voxels> fetch(int b, std::unique_lock<std::mutex> & lock, bool ahead){
+		while (true){
+			auto found = cache.find(b);
+			if (found != cache.end()){
+				Entry & entry = found->second;
+				lru.splice(lru.begin(), lru, entry.lru);
+				entry.generation = generation;
+				if (!ahead){
+					counters.hits++;
+					if (entry.prefetched) counters.prefetchHits++;
+					entry.prefetched = false;
+				}
+				return entry.voxels;
+			}
+			if (!loading.count(b)) break;
+			if (ahead) return std::shared_ptr<Voxels>();
+			loaded.wait(lock);
+		}
+
+		loading.insert(b);
+		lock.unlock();
+		std::shared_ptr<Voxels> voxels(new Voxels(recordSize));
+		bool ok = readAll(file, &(*voxels)[0], recordSize, dataOffset + (off_t)b*recordSize);
+		lock.lock();
+		loading.erase(b);
+		loaded.notify_all();
+		if (!ok){
+			// a short file reads as empty bricks
+			std::fill(voxels->begin(), voxels->end(), 0);
+			return voxels;
+		}
+		counters.bytesRead += recordSize;
+		if (ahead) counters.prefetched++;
+		else       counters.misses++;
+
+		if (makeRoom(ahead)){
+			Entry & entry = cache[b];
+			entry.voxels = voxels;
+			lru.push_front(b);
+			entry.lru = lru.begin();
+			entry.generation = generation;
+			entry.prefetched = ahead;
+			counters.residentBytes += recordSize;
+		}
+		return voxels;
+	}
+
+	static void prefetcher(){
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true){
+			wake.wait(lock, []{ return stopping || !prefetchQueue.empty(); });
+			if (stopping) return;
+			int b = prefetchQueue.front();
+			prefetchQueue.pop_front();
+			fetch(b, lock, true);
+		}
+	}
+
+	bool open(const std::string & path, size_t budget, int prefetchThreads){
+		close();
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		Header h;
+		if (!readAll(fd, &h, sizeof(h), 0) || strncmp(h.magic, "BRICKS1", 8) != 0
+		    || h.brick < 1 || h.pages < 1 || h.pages > 1024){
+			::close(fd);
+			return false;
+		}
+		int count = h.pages*h.pages*h.pages;
+		std::vector<unsigned char> largest(count);
+		if (!readAll(fd, &largest[0], count, sizeof(h))){
+			::close(fd);
+			return false;
+		}
+#ifdef POSIX_FADV_RANDOM
+		// bricks are read in view order : read ahead would only waste the
+		// page cache
+		posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+
+		file = fd;
+		header = h;
+		maxima.swap(largest);
+		int apron = h.brick + 2;
+		recordSize = (size_t)apron*apron*apron;
+		dataOffset = recordsOffset(count);
+		memset(&counters, 0, sizeof(counters));
+		counters.budget = budget;
+		counters.bricks = count;
+		counters.emptyBricks = (int)std::count(maxima.begin(), maxima.end(), 0);
+		stopping = false;
+		for (int i = 0; i < prefetchThreads; i++)
+			prefetchers.push_back(std::thread(prefetcher));
+		return true;
+	}
+
+	void close(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			prefetchQueue.clear();
+		}
+		wake.notify_all();
+		for (auto & thread : prefetchers)
+			thread.join();
+		prefetchers.clear();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		cache.clear();
+		lru.clear();
+		maxima.clear();
+		if (file >= 0) ::close(file);
+		file = -1;
+		counters.residentBytes = 0;
+	}
+
+	bool isOpen(){
+		return file >= 0;
+	}
+
+	int size(){
+		return isOpen() ? header.size : 0;
+	}
+
+	int brickSize(){
+		return isOpen() ? header.brick : 0;
+	}
+
+	static int brickAt(int x, int y, int z){
+		int pages = header.pages;
+		x = std::min(std::max(x / header.brick, 0), pages - 1);
+		y = std::min(std::max(y / header.brick, 0), pages - 1);
+		z = std::min(std::max(z / header.brick, 0), pages - 1);
+		return (x*pages + y)*pages + z;
+	}
+
+	void read(int x, int y, int z, int size, unsigned char * out){
+		int apron = size + 2;
+		size_t bytes = (size_t)apron*apron*apron;
+		int b = brickAt(x + 1, y + 1, z + 1);
+		if (!isOpen() || size != header.brick || maxima[b] == 0){
+			memset(out, 0, bytes);
+			return;
+		}
+		std::shared_ptr<Voxels> voxels;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			voxels = fetch(b, lock, false);
+		}
+		memcpy(out, &(*voxels)[0], bytes);
+	}
+
+	bool empty(glm::ivec3 min, glm::ivec3){
+		return !isOpen() || maxima[brickAt(min.x, min.y, min.z)] == 0;
+	}
+
+	void prefetch(const glm::mat4 & mvp, const glm::vec3 & eye, int maxBricks, float margin){
+		if (!isOpen()) return;
+
+		// the planes of the widened frustum, from the rows of mvp
+		glm::vec4 row[4];
+		for (int i = 0; i < 4; i++)
+			row[i] = glm::vec4(mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i]);
+		row[0] /= 1.0f + margin;
+		row[1] /= 1.0f + margin;
+		glm::vec4 planes[6] = {row[3] + row[0], row[3] - row[0], row[3] + row[1],
+		                       row[3] - row[1], row[3] + row[2], row[3] - row[2]};
+		float planeScale[6];
+		for (int p = 0; p < 6; p++)
+			planeScale[p] = glm::length(glm::vec3(planes[p]));
+
+		// every non empty brick whose bounding sphere touches it
+		int pages = header.pages, count = pages*pages*pages;
+		float scale = (float)header.brick / header.size;
+		float radius = 0.87f * scale;
+		std::vector< std::vector<std::pair<float,int> > > found(parallel_threads());
+		parallel_chunks(0, count, (int)found.size(), [&](int first, int last, int chunk){
+			for (int b = first; b < last; b++){
+				if (!maxima[b]) continue;
+				int x = b / (pages*pages), y = (b / pages) % pages, z = b % pages;
+				glm::vec3 center = (glm::vec3(z, y, x) + 0.5f) * scale;
+				bool inside = true;
+				for (int p = 0; p < 6 && inside; p++)
+					inside = glm::dot(glm::vec3(planes[p]), center) + planes[p].w >= -radius * planeScale[p];
+				if (!inside) continue;
+				glm::vec3 d = center - eye;
+				found[chunk].push_back(std::make_pair(glm::dot(d, d), b));
+			}
+		});
+		std::vector<std::pair<float,int> > wanted;
+		for (auto & list : found)
+			wanted.insert(wanted.end(), list.begin(), list.end());
+		std::sort(wanted.begin(), wanted.end());
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			generation++;
+			prefetchQueue.clear();
+			// nearest first, no more than the cache holds : the cached
+			// ones are kept from eviction, the others read
+			size_t room = counters.budget / recordSize;
+			for (size_t i = 0; i < wanted.size() && i < room && (int)prefetchQueue.size() < maxBricks; i++){
+				int b = wanted[i].second;
+				auto cached = cache.find(b);
+				if (cached != cache.end()){
+					cached->second.generation = generation;
+					lru.splice(lru.begin(), lru, cached->second.lru);
+				}
+				else if (!loading.count(b))
+					prefetchQueue.push_back(b);
+			}
+		}
+		wake.notify_all();
+	}
+
+	Stats stats(){
+		std::lock_guard<std::mutex> lock(mutex);
+		Stats s = counters;
+		s.residentBricks = (int)cache.size();
+		return s;
+	}
+}
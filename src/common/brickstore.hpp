@@ -0,0 +1,68 @@
+#ifndef BRICKSTORE_HPP
+#define BRICKSTORE_HPP
+
+#include <string>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+#include "virtualvolume.hpp"
+
+// A volume larger than host memory, read brick by brick from a bricked
+// file. Bricks read are kept in a host cache of fixed size, least
+// recently used out first ; the GPU side is the virtual volume atlas, fed
+// through read() and empty() as its generator and reject test.
+//
+// The file holds a header, the largest voxel of every brick (so empty
+// bricks are known without reading them), then every brick with the one
+// voxel apron virtualvolume wants, (brick+2)^3 voxels, z fastest. Empty
+// bricks are left as holes in a sparse file.
+namespace brickstore{
+
+	struct Stats{
+		size_t budget;          // bytes the cache may hold
+		size_t residentBytes;
+		int    residentBricks;  // in the host cache
+		int    bricks;          // in the volume
+		int    emptyBricks;     // never read : nothing in them
+		long   hits;            // reads served from the cache
+		long   misses;          // reads that waited for the disk
+		long   prefetched;      // bricks read ahead of being asked for
+		long   prefetchHits;    // reads served by a prefetched brick
+		long   evicted;
+		double bytesRead;       // from the disk
+	};
+
+	// Writes a size^3 volume of brick^3 bricks to path, generating every
+	// brick and its apron with generate, on all cores. Returns false if
+	// the file cannot be written.
+	bool write(const std::string & path, int size, int brick, virtualvolume::BrickGenerator generate);
+
+	// Opens a brick file, caching up to budget bytes of it. Returns false
+	// if it cannot be read.
+	bool open(const std::string & path, size_t budget, int prefetchThreads = 1);
+
+	// Waits for the prefetches in flight and closes the file
+	void close();
+
+	bool isOpen();
+	int size();        // voxels per side of the volume
+	int brickSize();   // voxels per side of a brick
+
+	// BrickGenerator : the brick whose apron starts at (x,y,z), from the
+	// cache or the disk. Thread safe.
+	void read(int x, int y, int z, int size, unsigned char * out);
+
+	// BrickReject : true if the brick at min is empty
+	bool empty(glm::ivec3 min, glm::ivec3 max);
+
+	// Queues for reading up to maxBricks uncached bricks in a frustum
+	// widened by margin (0.5 : half as wide again) around the current
+	// view, nearest to the eye first, so turning and moving find them in
+	// memory. Replaces the previous queue. mvp maps texture coordinates
+	// to clip space, eye is in texture coordinates.
+	void prefetch(const glm::mat4 & mvp, const glm::vec3 & eye, int maxBricks, float margin = 0.5f);
+
+	Stats stats();
+}
+
+#endif
@@ -0,0 +1,159 @@
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "mipmap.hpp"
+#include "brickupdate.hpp"
+#include "parallel.hpp"
+
+bool sameTextureLayout(const TextureData & a, const TextureData & b){
+	if (a.target != b.target || a.format != b.format || a.internalFormat != b.internalFormat)
+		return false;
+	if (a.levels.size() != b.levels.size())
+		return false;
+	for (size_t i = 0; i < a.levels.size(); i++){
+		const TextureLevel & la = a.levels[i], & lb = b.levels[i];
+		if (la.width != lb.width || la.height != lb.height || la.depth != lb.depth)
+			return false;
+	}
+	return true;
+}
+
+static const unsigned char * levelData(const TextureData & texture, const TextureLevel & level){
+	const unsigned char * base = texture.mapping ? texture.mapping : &texture.storage[0];
+	return base + level.offset;
+}
+
+void diffTextureBricks(const TextureData & before, const TextureData & after, int brick, std::vector<TextureBrick> & bricks){
+	bricks.clear();
+	int components = formatComponents(after.format);
+
+	for (size_t l = 0; l < after.levels.size(); l++){
+		const TextureLevel & level = after.levels[l];
+		int w = level.width, h = level.height, d = level.depth;
+		int bw = (w + brick-1) / brick, bh = (h + brick-1) / brick, bd = (d + brick-1) / brick;
+		const unsigned char * a = levelData(before, before.levels[l]);
+		const unsigned char * b = levelData(after, level);
+		size_t row = (size_t)w * components;
+
+		// one list per slab of bricks, joined in order afterwards
+		std::vector< std::vector<TextureBrick> > found(bd);
+		parallel_for(0, bd, [&](int first, int last){
+			for (int bz = first; bz < last; bz++)
+			for (int by = 0; by < bh; by++)
+			for (int bx = 0; bx < bw; bx++){
+				TextureBrick box = {(int)l, bx*brick, by*brick, bz*brick,
+					std::min(brick, w - bx*brick), std::min(brick, h - by*brick), std::min(brick, d - bz*brick)};
+				size_t span = (size_t)box.width * components;
+				bool changed = false;
+				for (int z = box.z; z < box.z + box.depth && !changed; z++)
+				for (int y = box.y; y < box.y + box.height && !changed; y++){
+					size_t offset = ((size_t)z*h + y) * row + (size_t)box.x * components;
+					changed = memcmp(a + offset, b + offset, span) != 0;
+				}
+				if (changed)
+					found[bz].push_back(box);
+			}
+		});
+		for (auto & slab : found)
+			bricks.insert(bricks.end(), slab.begin(), slab.end());
+	}
+}
+
+bool uploadTextureBricks(GLuint texture, const TextureData & data, const std::vector<TextureBrick> & bricks, GLuint & staging, size_t & bytes){
+	bytes = 0;
+	if (bricks.empty()) return true;
+	int components = formatComponents(data.format);
+
+	std::vector<size_t> offsets(bricks.size() + 1, 0);
+	for (size_t i = 0; i < bricks.size(); i++){
+		const TextureBrick & box = bricks[i];
+		offsets[i+1] = offsets[i] + (size_t)box.width * box.height * box.depth * components;
+	}
+	size_t total = offsets.back();
+
+	if (!staging)
+		glGenBuffers(1, &staging);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+	// orphans the previous contents instead of waiting for them
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, total, NULL, GL_STREAM_DRAW);
+	unsigned char * mapped = (unsigned char *)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if (!mapped){
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+
+	// packs each brick tightly, in parallel
+	parallel_for(0, (int)bricks.size(), [&](int first, int last){
+		for (int i = first; i < last; i++){
+			const TextureBrick & box = bricks[i];
+			const TextureLevel & level = data.levels[box.level];
+			const unsigned char * src = levelData(data, level);
+			size_t row = (size_t)level.width * components;
+			size_t span = (size_t)box.width * components;
+			unsigned char * dst = mapped + offsets[i];
+			for (int z = box.z; z < box.z + box.depth; z++)
+			for (int y = box.y; y < box.y + box.height; y++){
+				memcpy(dst, src + ((size_t)z*level.height + y) * row + (size_t)box.x * components, span);
+				dst += span;
+			}
+		}
+	});
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < bricks.size(); i++){
+		const TextureBrick & box = bricks[i];
+		glTexSubImage3D(GL_TEXTURE_3D, box.level, box.x, box.y, box.z, box.width, box.height, box.depth,
+			data.format, GL_UNSIGNED_BYTE, (const GLvoid *)offsets[i]);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	bytes = total;
+	return true;
+}
+
+bool uploadTextureLevels(GLuint texture, const TextureData & data, GLuint & staging, size_t & bytes){
+	bytes = 0;
+	if (data.levels.empty()) return true;
+
+	std::vector<size_t> offsets(data.levels.size() + 1, 0);
+	for (size_t i = 0; i < data.levels.size(); i++)
+		offsets[i+1] = offsets[i] + data.levels[i].size;
+	size_t total = offsets.back();
+
+	if (!staging)
+		glGenBuffers(1, &staging);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, total, NULL, GL_STREAM_DRAW);
+	unsigned char * mapped = (unsigned char *)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if (!mapped){
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+	for (size_t i = 0; i < data.levels.size(); i++)
+		memcpy(mapped + offsets[i], levelData(data, data.levels[i]), data.levels[i].size);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	GLenum target = data.target;
+	glBindTexture(target, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < data.levels.size(); i++){
+		const TextureLevel & l = data.levels[i];
+		const GLvoid * offset = (const GLvoid *)offsets[i];
+		if (data.format == 0 && target == GL_TEXTURE_3D)
+			glCompressedTexSubImage3D(target, i, 0, 0, 0, l.width, l.height, l.depth, data.internalFormat, l.size, offset);
+		else if (data.format == 0)
+			glCompressedTexSubImage2D(target, i, 0, 0, l.width, l.height, data.internalFormat, l.size, offset);
+		else if (target == GL_TEXTURE_3D)
+			glTexSubImage3D(target, i, 0, 0, 0, l.width, l.height, l.depth, data.format, GL_UNSIGNED_BYTE, offset);
+		else
+			glTexSubImage2D(target, i, 0, 0, l.width, l.height, data.format, GL_UNSIGNED_BYTE, offset);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	bytes = total;
+	return true;
+}
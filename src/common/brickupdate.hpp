@@ -0,0 +1,43 @@
+#ifndef BRICKUPDATE_HPP
+#define BRICKUPDATE_HPP
+
+#include <vector>
+#include <cstddef>
+#include <GL/glew.h>
+
+#include "texture.hpp"
+
+// A box of one level of a 3D texture, in texels
+struct TextureBrick{
+	int level;
+	int x, y, z;
+	int width, height, depth;
+};
+
+// True if two decoded images have the same target, format and level
+// sizes, so one can be uploaded over the other with glTexSubImage3D
+bool sameTextureLayout(const TextureData & a, const TextureData & b);
+
+// Lists the bricks (brick^3 texels, smaller at the borders) of every
+// level of after that differ from before. Both must be uncompressed 3D
+// images of the same layout. Levels are compared slab by slab on all
+// cores.
+void diffTextureBricks(const TextureData & before, const TextureData & after, int brick, std::vector<TextureBrick> & bricks);
+
+// Uploads the given bricks of data into texture, an existing texture
+// of the same layout. The bricks are packed into staging, a pixel
+// buffer object created on first use and kept for the next update, so
+// the driver gets one transfer and no client memory to copy.
+// bytes receives the number of bytes uploaded. Returns false, with
+// nothing uploaded, if the pixel buffer could not be mapped.
+bool uploadTextureBricks(GLuint texture, const TextureData & data, const std::vector<TextureBrick> & bricks, GLuint & staging, size_t & bytes);
+
+// Uploads every level of data, compressed or not, over texture, an
+// existing texture of the same layout, through staging as above. Returns
+// once the pixels are in the buffer ; the transfer into the texture
+// goes on while the GPU draws from other textures.
+// bytes receives the number of bytes uploaded. Returns false, with
+// nothing uploaded, if the pixel buffer could not be mapped.
+bool uploadTextureLevels(GLuint texture, const TextureData & data, GLuint & staging, size_t & bytes);
+
+#endif
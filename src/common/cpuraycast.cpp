@@ -0,0 +1,480 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "sampler.hpp"
+#include "cpuraycast.hpp"
+#include "raybox.hpp"
+#include "parallel.hpp"
+#include "numa.hpp"
+
+#ifdef SAMPLER_X86
+#define CPURAYCAST_X86
+#endif
+
+// same limit as the fragment program
+#define MAX_STEPS 1000
+
+bool cpuRayPathSupported(CpuRayPath path){
+	switch (path){
+	case CPU_RAY_AUTO:
+	case CPU_RAY_SCALAR: return true;
+#ifdef CPURAYCAST_X86
+	case CPU_RAY_AVX2:   return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	case CPU_RAY_AVX512: return __builtin_cpu_supports("avx512f");
+#endif
+	default:             return false;
+	}
+}
+
+const char * cpuRayPathName(CpuRayPath path){
+	switch (path){
+	case CPU_RAY_SCALAR: return "scalar";
+	case CPU_RAY_AVX2:   return "avx2";
+	case CPU_RAY_AVX512: return "avx512";
+	default:             return "auto";
+	}
+}
+
+// A batch of rays, structure of arrays ; rays that miss the volume have
+// a zero length
+struct RayPacket{
+	float px[16], py[16], pz[16];
+	float dx[16], dy[16], dz[16];
+	float len[16];
+	float depth[16];   // from the near plane to the entry point
+};
+
+// Entry point, normalized direction and length of the ray through the
+// center of pixel (x,y), inside the box [boxmin, boxmax]
+static void setupRay(const glm::mat4 & inverse, const glm::vec3 & boxmin, const glm::vec3 & boxmax,
+                     int x, int y, int width, int height, RayPacket & packet, int lane){
+	glm::vec2 ndc((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f);
+	glm::vec4 n = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+	glm::vec4 f = inverse * glm::vec4(ndc,  1.0f, 1.0f);
+	glm::vec3 origin = glm::vec3(n) / n.w;
+	glm::vec3 dir = glm::normalize(glm::vec3(f) / f.w - origin);
+
+	float tnear, tfar;
+	bool hit = intersectBox(origin, dir, boxmin, boxmax, tnear, tfar);
+	tnear = std::max(tnear, 0.0f);
+	glm::vec3 start = origin + dir * tnear;
+	packet.px[lane] = start.x; packet.py[lane] = start.y; packet.pz[lane] = start.z;
+	packet.dx[lane] = dir.x;   packet.dy[lane] = dir.y;   packet.dz[lane] = dir.z;
+	packet.len[lane] = hit ? tfar - tnear : 0.0f;
+	packet.depth[lane] = hit ? tnear : INFINITY;
+}
+
+// Accumulated color of a packet, structure of arrays
+struct PacketColor{
+	float r[16], g[16], b[16], a[16];
+	float opacity[16];   // alpha_acc of the fragment program
+	float sr[16], sg[16], sb[16], sa[16];   // the sums without 1 - alpha_acc
+};
+
+static void storePixel(unsigned char * rgba, const PacketColor & color, int lane){
+	float channels[4] = {color.r[lane], color.g[lane], color.b[lane], color.a[lane]};
+	for (int c = 0; c < 4; c++)
+		rgba[c] = (unsigned char)(std::min(std::max(channels[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+static void storeFragment(CpuRayFragment & fragment, const RayPacket & packet, const PacketColor & color, int lane){
+	fragment.r = color.r[lane];
+	fragment.g = color.g[lane];
+	fragment.b = color.b[lane];
+	fragment.a = color.a[lane];
+	fragment.opacity = color.opacity[lane];
+	fragment.sr = color.sr[lane];
+	fragment.sg = color.sg[lane];
+	fragment.sb = color.sb[lane];
+	fragment.sa = color.sa[lane];
+	fragment.depth = packet.depth[lane];
+}
+
+// The render modes a kernel is compiled for. With FixedModes they are
+// known at compile time and every test on them folds away ; RuntimeModes
+// tests them at every sample, as the fragment program does.
+template<unsigned int MODES>
+struct FixedModes{
+	FixedModes(unsigned int) {}
+	bool operator()(unsigned int mode) const { return (MODES & mode) != 0; }
+};
+
+struct RuntimeModes{
+	unsigned int modes;
+	RuntimeModes(unsigned int modes) : modes(modes) {}
+	bool operator()(unsigned int mode) const { return (modes & mode) != 0; }
+};
+
+// Not a render mode : the kernel also sums the color without the
+// 1 - alpha_acc weights, for sort-last compositing. The kernels compiled
+// for fixed modes never do, so only the one testing the modes at every
+// sample pays for it.
+static const unsigned int CPU_MODE_SUMS = CPU_MODE_COUNT;
+
+// HSVtoRGB of the fragment program
+static void hsvToRgb(float h, float s, float v, float & r, float & g, float & b){
+	float c = v * s;
+	float x = c * (1.0f - fabsf(fmodf(h * 6.0f, 2.0f) - 1.0f));
+	r = g = b = 0;
+	if (s != 0){
+		float i = floorf(h * 6.0f);
+		if      (i == 0) { r = c; g = x; }
+		else if (i == 1) { r = x; g = c; }
+		else if (i == 2) { g = c; b = x; }
+		else if (i == 3) { g = x; b = c; }
+		else if (i == 4) { r = x; b = c; }
+		else             { r = c; b = x; }
+	}
+	float m = v - c;
+	r += m; g += m; b += m;
+}
+
+// the false colors of xray_mode, once per pixel
+template<class Modes>
+static void finishPacket(const Modes & modes, PacketColor & color, int lanes){
+	if (!modes(CPU_MODE_XRAY)) return;
+	for (int lane = 0; lane < lanes; lane++){
+		float r, g, b;
+		hsvToRgb(0.55f, color.g[lane], color.g[lane] * 2.0f, r, g, b);
+		hsvToRgb(g, 1.0f, 1.0f, color.r[lane], color.g[lane], color.b[lane]);
+	}
+}
+
+template<class Modes>
+static void marchScalar(const SamplerVolume & volume, const CpuRayOptions & options, const RayPacket & packet, PacketColor & color){
+	Modes modes(options.modes);
+	float x = packet.px[0], y = packet.py[0], z = packet.pz[0];
+	float len = packet.len[0];
+	float col_r = 0, col_g = 0, col_b = 0, col_a = 0;
+	float sum_r = 0, sum_g = 0, sum_b = 0, sum_a = 0;
+	float alpha_acc = 0, length_acc = 0, lastsample = 0;
+	if (len > 0)
+	for (int i = 0; i < MAX_STEPS; i++){
+		// luminance texture : alpha is 1
+		float density = modes(CPU_MODE_FILL) ? 1.0f : sampleVolume(volume, x, y, z);
+		float opacity = modes(CPU_MODE_FILL) ? 0.1f : 1.0f;
+		float delta = modes(CPU_MODE_ADAPTIVE) ? options.stepsize + density * (1.0f / 255.0f) : options.stepsize;
+		float r = density, g = density, b = density;
+		if (modes(CPU_MODE_COLOR)){
+			hsvToRgb((density - lastsample) * options.stepsize / delta, density, density, r, g, b);
+			lastsample = r;
+		}
+		float weight = (1.0f - alpha_acc) * opacity * delta * 3.0f;
+		col_r     += weight * r;
+		col_g     += weight * g;
+		col_b     += weight * b;
+		col_a     += weight * opacity;
+		if (modes(CPU_MODE_SUMS)){
+			float raw = opacity * delta * 3.0f;
+			sum_r += raw * r;
+			sum_g += raw * g;
+			sum_b += raw * b;
+			sum_a += raw * opacity;
+		}
+		alpha_acc += opacity * delta;
+		x += packet.dx[0] * delta;
+		y += packet.dy[0] * delta;
+		z += packet.dz[0] * delta;
+		length_acc += delta;
+		if (length_acc >= len || alpha_acc > 1.0f) break;
+	}
+	color.r[0] = col_r; color.g[0] = col_g; color.b[0] = col_b; color.a[0] = col_a;
+	color.opacity[0] = alpha_acc;
+	color.sr[0] = sum_r; color.sg[0] = sum_g; color.sb[0] = sum_b; color.sa[0] = sum_a;
+	finishPacket(modes, color, 1);
+}
+
+#ifdef CPURAYCAST_X86
+
+// hsvToRgb on 8 lanes
+__attribute__((target("avx2,fma")))
+static inline void hsvToRgbAVX2(__m256 h, __m256 s, __m256 v, __m256 & r, __m256 & g, __m256 & b){
+	__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), two = _mm256_set1_ps(2.0f);
+	__m256 c = _mm256_mul_ps(v, s);
+	__m256 h6 = _mm256_mul_ps(h, _mm256_set1_ps(6.0f));
+	__m256 mod = _mm256_fnmadd_ps(_mm256_round_ps(_mm256_div_ps(h6, two), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC), two, h6);
+	__m256 distance = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(mod, one));
+	__m256 x = _mm256_mul_ps(c, _mm256_sub_ps(one, distance));
+	__m256 i = _mm256_floor_ps(h6);
+	__m256 i0 = _mm256_cmp_ps(i, zero, _CMP_EQ_OQ), i1 = _mm256_cmp_ps(i, one, _CMP_EQ_OQ);
+	__m256 i2 = _mm256_cmp_ps(i, two, _CMP_EQ_OQ), i3 = _mm256_cmp_ps(i, _mm256_set1_ps(3.0f), _CMP_EQ_OQ);
+	__m256 i4 = _mm256_cmp_ps(i, _mm256_set1_ps(4.0f), _CMP_EQ_OQ);
+	__m256 i5 = _mm256_andnot_ps(_mm256_or_ps(_mm256_or_ps(i0, i1), _mm256_or_ps(_mm256_or_ps(i2, i3), i4)), _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+	// sextant by sextant : (c,x,0) (x,c,0) (0,c,x) (0,x,c) (x,0,c) (c,0,x)
+	r = _mm256_or_ps(_mm256_and_ps(_mm256_or_ps(i0, i5), c), _mm256_and_ps(_mm256_or_ps(i1, i4), x));
+	g = _mm256_or_ps(_mm256_and_ps(_mm256_or_ps(i1, i2), c), _mm256_and_ps(_mm256_or_ps(i0, i3), x));
+	b = _mm256_or_ps(_mm256_and_ps(_mm256_or_ps(i3, i4), c), _mm256_and_ps(_mm256_or_ps(i2, i5), x));
+	__m256 saturated = _mm256_cmp_ps(s, zero, _CMP_NEQ_UQ);
+	__m256 m = _mm256_sub_ps(v, c);
+	r = _mm256_add_ps(_mm256_and_ps(r, saturated), m);
+	g = _mm256_add_ps(_mm256_and_ps(g, saturated), m);
+	b = _mm256_add_ps(_mm256_and_ps(b, saturated), m);
+}
+
+template<class Modes>
+__attribute__((target("avx2,fma")))
+static void marchAVX2(const SamplerVolume & volume, const CpuRayOptions & options, const RayPacket & packet, PacketColor & color){
+	Modes modes(options.modes);
+	__m256 x = _mm256_loadu_ps(packet.px), y = _mm256_loadu_ps(packet.py), z = _mm256_loadu_ps(packet.pz);
+	__m256 dx = _mm256_loadu_ps(packet.dx), dy = _mm256_loadu_ps(packet.dy), dz = _mm256_loadu_ps(packet.dz);
+	__m256 len = _mm256_loadu_ps(packet.len);
+	__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f), three = _mm256_set1_ps(3.0f);
+	__m256 inv255 = _mm256_set1_ps(1.0f / 255.0f), step = _mm256_set1_ps(options.stepsize);
+	__m256 opacity = modes(CPU_MODE_FILL) ? _mm256_set1_ps(0.1f) : one;
+	__m256 col_r = zero, col_g = zero, col_b = zero, col_a = zero;
+	__m256 sum_r = zero, sum_g = zero, sum_b = zero, sum_a = zero;
+	__m256 alpha_acc = zero, length_acc = zero, lastsample = zero;
+	__m256 active = _mm256_cmp_ps(len, zero, _CMP_GT_OQ);
+
+	for (int i = 0; i < MAX_STEPS && _mm256_movemask_ps(active); i++){
+		__m256 density = modes(CPU_MODE_FILL) ? one : sampleVolumeAVX2(volume, x, y, z, active);
+		__m256 delta = modes(CPU_MODE_ADAPTIVE) ? _mm256_fmadd_ps(density, inv255, step) : step;
+		__m256 r = density, g = density, b = density;
+		if (modes(CPU_MODE_COLOR)){
+			__m256 hue = _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(density, lastsample), step), delta);
+			hsvToRgbAVX2(hue, density, density, r, g, b);
+			lastsample = r;
+		}
+		// finished lanes stand still
+		delta = _mm256_and_ps(delta, active);
+		__m256 alpha_sample = _mm256_mul_ps(opacity, delta);
+		__m256 weight = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(one, alpha_acc), alpha_sample), three);
+		col_r      = _mm256_fmadd_ps(weight, r, col_r);
+		col_g      = _mm256_fmadd_ps(weight, g, col_g);
+		col_b      = _mm256_fmadd_ps(weight, b, col_b);
+		col_a      = _mm256_fmadd_ps(weight, opacity, col_a);
+		if (modes(CPU_MODE_SUMS)){
+			__m256 raw = _mm256_mul_ps(alpha_sample, three);
+			sum_r = _mm256_fmadd_ps(raw, r, sum_r);
+			sum_g = _mm256_fmadd_ps(raw, g, sum_g);
+			sum_b = _mm256_fmadd_ps(raw, b, sum_b);
+			sum_a = _mm256_fmadd_ps(raw, opacity, sum_a);
+		}
+		alpha_acc  = _mm256_add_ps(alpha_acc, alpha_sample);
+		x = _mm256_fmadd_ps(dx, delta, x);
+		y = _mm256_fmadd_ps(dy, delta, y);
+		z = _mm256_fmadd_ps(dz, delta, z);
+		length_acc = _mm256_add_ps(length_acc, delta);
+		active = _mm256_and_ps(active, _mm256_and_ps(_mm256_cmp_ps(length_acc, len, _CMP_LT_OQ),
+		                                             _mm256_cmp_ps(alpha_acc, one, _CMP_LE_OQ)));
+	}
+	_mm256_storeu_ps(color.r, col_r);
+	_mm256_storeu_ps(color.g, col_g);
+	_mm256_storeu_ps(color.b, col_b);
+	_mm256_storeu_ps(color.a, col_a);
+	_mm256_storeu_ps(color.opacity, alpha_acc);
+	_mm256_storeu_ps(color.sr, sum_r);
+	_mm256_storeu_ps(color.sg, sum_g);
+	_mm256_storeu_ps(color.sb, sum_b);
+	_mm256_storeu_ps(color.sa, sum_a);
+	finishPacket(modes, color, 8);
+}
+
+// hsvToRgb on 16 lanes
+__attribute__((target("avx512f")))
+static inline void hsvToRgbAVX512(__m512 h, __m512 s, __m512 v, __m512 & r, __m512 & g, __m512 & b){
+	__m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f), two = _mm512_set1_ps(2.0f);
+	__m512 c = _mm512_mul_ps(v, s);
+	__m512 h6 = _mm512_mul_ps(h, _mm512_set1_ps(6.0f));
+	__m512 mod = _mm512_fnmadd_ps(_mm512_roundscale_ps(_mm512_div_ps(h6, two), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC), two, h6);
+	__m512 x = _mm512_mul_ps(c, _mm512_sub_ps(one, _mm512_abs_ps(_mm512_sub_ps(mod, one))));
+	__m512 i = _mm512_floor_ps(h6);
+	__mmask16 i0 = _mm512_cmp_ps_mask(i, zero, _CMP_EQ_OQ), i1 = _mm512_cmp_ps_mask(i, one, _CMP_EQ_OQ);
+	__mmask16 i2 = _mm512_cmp_ps_mask(i, two, _CMP_EQ_OQ), i3 = _mm512_cmp_ps_mask(i, _mm512_set1_ps(3.0f), _CMP_EQ_OQ);
+	__mmask16 i4 = _mm512_cmp_ps_mask(i, _mm512_set1_ps(4.0f), _CMP_EQ_OQ);
+	__mmask16 i5 = ~(i0 | i1 | i2 | i3 | i4);
+	__mmask16 saturated = _mm512_cmp_ps_mask(s, zero, _CMP_NEQ_UQ);
+	// sextant by sextant : (c,x,0) (x,c,0) (0,c,x) (0,x,c) (x,0,c) (c,0,x)
+	r = _mm512_mask_mov_ps(_mm512_maskz_mov_ps((i0 | i5) & saturated, c), (i1 | i4) & saturated, x);
+	g = _mm512_mask_mov_ps(_mm512_maskz_mov_ps((i1 | i2) & saturated, c), (i0 | i3) & saturated, x);
+	b = _mm512_mask_mov_ps(_mm512_maskz_mov_ps((i3 | i4) & saturated, c), (i2 | i5) & saturated, x);
+	__m512 m = _mm512_sub_ps(v, c);
+	r = _mm512_add_ps(r, m);
+	g = _mm512_add_ps(g, m);
+	b = _mm512_add_ps(b, m);
+}
+
+template<class Modes>
+__attribute__((target("avx512f")))
+static void marchAVX512(const SamplerVolume & volume, const CpuRayOptions & options, const RayPacket & packet, PacketColor & color){
+	Modes modes(options.modes);
+	__m512 x = _mm512_loadu_ps(packet.px), y = _mm512_loadu_ps(packet.py), z = _mm512_loadu_ps(packet.pz);
+	__m512 dx = _mm512_loadu_ps(packet.dx), dy = _mm512_loadu_ps(packet.dy), dz = _mm512_loadu_ps(packet.dz);
+	__m512 len = _mm512_loadu_ps(packet.len);
+	__m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f), three = _mm512_set1_ps(3.0f);
+	__m512 inv255 = _mm512_set1_ps(1.0f / 255.0f), step = _mm512_set1_ps(options.stepsize);
+	__m512 opacity = modes(CPU_MODE_FILL) ? _mm512_set1_ps(0.1f) : one;
+	__m512 col_r = zero, col_g = zero, col_b = zero, col_a = zero;
+	__m512 sum_r = zero, sum_g = zero, sum_b = zero, sum_a = zero;
+	__m512 alpha_acc = zero, length_acc = zero, lastsample = zero;
+	__mmask16 active = _mm512_cmp_ps_mask(len, zero, _CMP_GT_OQ);
+
+	for (int i = 0; i < MAX_STEPS && active; i++){
+		__m512 density = modes(CPU_MODE_FILL) ? one : sampleVolumeAVX512(volume, x, y, z, active);
+		__m512 delta = modes(CPU_MODE_ADAPTIVE) ? _mm512_fmadd_ps(density, inv255, step) : step;
+		__m512 r = density, g = density, b = density;
+		if (modes(CPU_MODE_COLOR)){
+			__m512 hue = _mm512_div_ps(_mm512_mul_ps(_mm512_sub_ps(density, lastsample), step), delta);
+			hsvToRgbAVX512(hue, density, density, r, g, b);
+			lastsample = r;
+		}
+		// finished lanes stand still
+		delta = _mm512_maskz_mov_ps(active, delta);
+		__m512 alpha_sample = _mm512_mul_ps(opacity, delta);
+		__m512 weight = _mm512_mul_ps(_mm512_mul_ps(_mm512_sub_ps(one, alpha_acc), alpha_sample), three);
+		col_r      = _mm512_fmadd_ps(weight, r, col_r);
+		col_g      = _mm512_fmadd_ps(weight, g, col_g);
+		col_b      = _mm512_fmadd_ps(weight, b, col_b);
+		col_a      = _mm512_fmadd_ps(weight, opacity, col_a);
+		if (modes(CPU_MODE_SUMS)){
+			__m512 raw = _mm512_mul_ps(alpha_sample, three);
+			sum_r = _mm512_fmadd_ps(raw, r, sum_r);
+			sum_g = _mm512_fmadd_ps(raw, g, sum_g);
+			sum_b = _mm512_fmadd_ps(raw, b, sum_b);
+			sum_a = _mm512_fmadd_ps(raw, opacity, sum_a);
+		}
+		alpha_acc  = _mm512_add_ps(alpha_acc, alpha_sample);
+		x = _mm512_fmadd_ps(dx, delta, x);
+		y = _mm512_fmadd_ps(dy, delta, y);
+		z = _mm512_fmadd_ps(dz, delta, z);
+		length_acc = _mm512_add_ps(length_acc, delta);
+		active = _mm512_mask_cmp_ps_mask(active, length_acc, len, _CMP_LT_OQ)
+		       & _mm512_cmp_ps_mask(alpha_acc, one, _CMP_LE_OQ);
+	}
+	_mm512_storeu_ps(color.r, col_r);
+	_mm512_storeu_ps(color.g, col_g);
+	_mm512_storeu_ps(color.b, col_b);
+	_mm512_storeu_ps(color.a, col_a);
+	_mm512_storeu_ps(color.opacity, alpha_acc);
+	_mm512_storeu_ps(color.sr, sum_r);
+	_mm512_storeu_ps(color.sg, sum_g);
+	_mm512_storeu_ps(color.sb, sum_b);
+	_mm512_storeu_ps(color.sa, sum_a);
+	finishPacket(modes, color, 16);
+}
+
+#endif
+
+typedef void (*MarchKernel)(const SamplerVolume & volume, const CpuRayOptions & options, const RayPacket & packet, PacketColor & color);
+
+// one kernel per combination of modes, indexed by the CpuRayMode bitset
+#define MARCH_KERNELS(march) { \
+	march<FixedModes<0> >,  march<FixedModes<1> >,  march<FixedModes<2> >,  march<FixedModes<3> >, \
+	march<FixedModes<4> >,  march<FixedModes<5> >,  march<FixedModes<6> >,  march<FixedModes<7> >, \
+	march<FixedModes<8> >,  march<FixedModes<9> >,  march<FixedModes<10> >, march<FixedModes<11> >, \
+	march<FixedModes<12> >, march<FixedModes<13> >, march<FixedModes<14> >, march<FixedModes<15> > }
+
+// the same for the vector paths, where only the xray combinations gain
+// from their own kernel (1.1 to 1.3x) ; with all 16 instantiated the
+// others ran within noise of the kernel testing the modes (0.87 to 1.07x),
+// so they share it, and --cpu-bench times them once as "runtime"
+#define MARCH_XRAY_KERNELS(march) { \
+	march<RuntimeModes>,    march<RuntimeModes>,    march<RuntimeModes>,    march<RuntimeModes>, \
+	march<FixedModes<4> >,  march<FixedModes<5> >,  march<FixedModes<6> >,  march<FixedModes<7> >, \
+	march<RuntimeModes>,    march<RuntimeModes>,    march<RuntimeModes>,    march<RuntimeModes>, \
+	march<FixedModes<12> >, march<FixedModes<13> >, march<FixedModes<14> >, march<FixedModes<15> > }
+
+static MarchKernel marchKernel(CpuRayPath path, const CpuRayOptions & options){
+	static const MarchKernel scalar[CPU_MODE_COUNT] = MARCH_KERNELS(marchScalar);
+#ifdef CPURAYCAST_X86
+	static const MarchKernel avx2[CPU_MODE_COUNT]   = MARCH_XRAY_KERNELS(marchAVX2);
+	static const MarchKernel avx512[CPU_MODE_COUNT] = MARCH_XRAY_KERNELS(marchAVX512);
+#endif
+	unsigned int modes = options.modes % CPU_MODE_COUNT;
+	switch (path){
+#ifdef CPURAYCAST_X86
+	case CPU_RAY_AVX2:   return options.runtime ? marchAVX2<RuntimeModes>   : avx2[modes];
+	case CPU_RAY_AVX512: return options.runtime ? marchAVX512<RuntimeModes> : avx512[modes];
+#endif
+	default:             return options.runtime ? marchScalar<RuntimeModes> : scalar[modes];
+	}
+}
+
+bool cpuRayModesCompiled(CpuRayPath path, unsigned int modes){
+	CpuRayOptions compiled = {1, modes, false}, runtime = {1, modes, true};
+	return marchKernel(path, compiled) != marchKernel(path, runtime);
+}
+
+// renders the rays inside [boxmin, boxmax] with replicas[node] on the
+// workers of each NUMA node, share of shares of the cores ; store(x, y,
+// packet, color, lane) keeps each pixel
+template<class Store>
+static CpuRayPath renderTiles(const SamplerVolume * replicas, int count, const glm::vec3 & boxmin, const glm::vec3 & boxmax,
+                              const glm::mat4 & mvp, const CpuRayOptions & options, int width, int height,
+                              CpuRayPath path, int share, int shares, Store store){
+	if (path == CPU_RAY_AUTO)
+		path = cpuRayPathSupported(CPU_RAY_AVX512) ? CPU_RAY_AVX512 :
+		       cpuRayPathSupported(CPU_RAY_AVX2)   ? CPU_RAY_AVX2   : CPU_RAY_SCALAR;
+	if (!cpuRayPathSupported(path))
+		path = CPU_RAY_SCALAR;
+
+	// tiles of 4 pixels across, as many rows as the packet needs
+	int lanes = path == CPU_RAY_AVX512 ? 16 : path == CPU_RAY_AVX2 ? 8 : 1;
+	int tileWidth = lanes == 1 ? 1 : 4, tileHeight = lanes / tileWidth;
+	int tilesX = (width + tileWidth - 1) / tileWidth;
+	int tilesY = (height + tileHeight - 1) / tileHeight;
+	glm::mat4 inverse = glm::inverse(mvp);
+	// the modes are picked once per frame, not per sample
+	MarchKernel march = marchKernel(path, options);
+
+	int workers = std::max(parallel_threads() / shares, 1);
+	parallel_chunks(0, tilesY, workers, [&](int first, int last, int chunk){
+		// each worker stays on one core, next to its replica
+		NumaPin pin(share * workers + chunk, shares * workers);
+		const SamplerVolume & volume = replicas[pin.node() % count];
+		RayPacket packet;
+		PacketColor color;
+		for (int ty = first; ty < last; ty++)
+		for (int tx = 0; tx < tilesX; tx++){
+			for (int lane = 0; lane < lanes; lane++){
+				int x = tx*tileWidth + lane % tileWidth, y = ty*tileHeight + lane / tileWidth;
+				setupRay(inverse, boxmin, boxmax, std::min(x, width-1), std::min(y, height-1), width, height, packet, lane);
+			}
+
+			march(volume, options, packet, color);
+
+			for (int lane = 0; lane < lanes; lane++){
+				int x = tx*tileWidth + lane % tileWidth, y = ty*tileHeight + lane / tileWidth;
+				if (x < width && y < height)
+					store(x, y, packet, color, lane);
+			}
+		}
+	});
+	return path;
+}
+
+static CpuRayPath renderVolumeCPU(const SamplerVolume * replicas, int count, const glm::mat4 & mvp, const CpuRayOptions & options,
+                                  int width, int height, unsigned char * rgba, CpuRayPath path){
+	return renderTiles(replicas, count, glm::vec3(0.0f), glm::vec3(1.0f), mvp, options, width, height, path, 0, 1,
+		[=](int x, int y, const RayPacket &, const PacketColor & color, int lane){
+			storePixel(rgba + ((size_t)y*width + x)*4, color, lane);
+		});
+}
+
+CpuRayPath renderVolumeCPU(const SamplerVolume & volume, const glm::mat4 & mvp, const CpuRayOptions & options,
+                           int width, int height, unsigned char * rgba, CpuRayPath path){
+	return renderVolumeCPU(&volume, 1, mvp, options, width, height, rgba, path);
+}
+
+CpuRayPath renderVolumeCPU(const std::vector<SamplerVolume> & replicas, const glm::mat4 & mvp, const CpuRayOptions & options,
+                           int width, int height, unsigned char * rgba, CpuRayPath path){
+	return renderVolumeCPU(&replicas[0], (int)replicas.size(), mvp, options, width, height, rgba, path);
+}
+
+CpuRayPath renderVolumeBoxCPU(const SamplerVolume & volume, const glm::vec3 & boxmin, const glm::vec3 & boxmax,
+                              const glm::mat4 & mvp, const CpuRayOptions & options, int width, int height,
+                              CpuRayFragment * fragments, CpuRayPath path, int share, int shares){
+	// the false colors are per pixel : they do not composite. The sums
+	// come from the kernel testing the modes, the only one keeping them
+	CpuRayOptions composable = options;
+	composable.modes = (composable.modes & ~CPU_MODE_XRAY) | CPU_MODE_SUMS;
+	composable.runtime = true;
+	return renderTiles(&volume, 1, boxmin, boxmax, mvp, composable, width, height, path, share, std::max(shares, 1),
+		[=](int x, int y, const RayPacket & packet, const PacketColor & color, int lane){
+			storeFragment(fragments[(size_t)y*width + x], packet, color, lane);
+		});
+}
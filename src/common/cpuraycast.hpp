@@ -0,0 +1,84 @@
+#ifndef CPURAYCAST_HPP
+#define CPURAYCAST_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "sampler.hpp"
+
+enum CpuRayPath{
+	CPU_RAY_AUTO,     // the widest path the processor supports
+	CPU_RAY_SCALAR,   // one ray at a time
+	CPU_RAY_AVX2,     // packets of 4x2 rays
+	CPU_RAY_AVX512    // packets of 4x4 rays
+};
+
+// The render modes of fragment_main the CPU renderer follows, as a bitset
+enum CpuRayMode{
+	CPU_MODE_ADAPTIVE = 1,   // steps grow with the density, as adaptive_mode
+	CPU_MODE_FILL     = 2,   // the volume as a uniform fog, as fill_mode
+	CPU_MODE_XRAY     = 4,   // false color of the result, as xray_mode
+	CPU_MODE_COLOR    = 8,   // hue from the change in density, as color_mode
+	CPU_MODE_COUNT    = 16   // combinations of the above
+};
+
+struct CpuRayOptions{
+	float        stepsize;
+	unsigned int modes;      // CpuRayMode flags
+	bool         runtime;    // one kernel testing the modes at every sample,
+	                         // as the fragment program does, instead of the
+	                         // one compiled for these modes, where there is
+	                         // one : every combination on the scalar path,
+	                         // those with xray on the vector paths
+};
+
+bool cpuRayPathSupported(CpuRayPath path);
+
+// True if path has a kernel of its own for modes, false if it runs them
+// with the one testing the modes at every sample
+bool cpuRayModesCompiled(CpuRayPath path, unsigned int modes);
+const char * cpuRayPathName(CpuRayPath path);
+
+// Renders the volume, prepared with prepareSamplerVolume and living in
+// the unit cube, as fragment_main does with the modes of options.
+// mvp maps the unit cube to clip space.
+// rgba receives width*height pixels, bottom row first as glReadPixels
+// returns them. Tiles of rays are marched together on the vector paths,
+// lanes dropping out as their rays end, and rows of tiles are spread
+// over all cores, each worker pinned to its own core when there are
+// several NUMA nodes. Returns the path used.
+CpuRayPath renderVolumeCPU(const SamplerVolume & volume, const glm::mat4 & mvp, const CpuRayOptions & options,
+                           int width, int height, unsigned char * rgba, CpuRayPath path = CPU_RAY_AUTO);
+
+// Same with the volume copied to every node by replicateVolume : workers
+// read the replica in their own node's memory
+CpuRayPath renderVolumeCPU(const std::vector<SamplerVolume> & replicas, const glm::mat4 & mvp, const CpuRayOptions & options,
+                           int width, int height, unsigned char * rgba, CpuRayPath path = CPU_RAY_AUTO);
+
+// One pixel of a partial image, for sort-last rendering : the color
+// accumulated along the part of the ray inside a box, as the fragment
+// program does, its opacity (alpha_acc, not clamped), the same color
+// without the 1 - alpha_acc weights (the sum of 3 * opacity * delta * c
+// over the samples, per channel), and the distance from the near plane
+// to where the ray entered the box. Rays that miss the box have no
+// color, no opacity and an infinite depth.
+struct CpuRayFragment{
+	float r, g, b, a;
+	float opacity;
+	float sr, sg, sb, sa;
+	float depth;
+};
+
+// Same as renderVolumeCPU, marching only the part of each ray inside
+// [boxmin, boxmax] (within the unit cube) and keeping the fragments
+// unrounded, so that the images of disjoint boxes can be composited.
+// The render runs on the share-th of shares equal parts of the cores,
+// for several renders at once on one machine. xray_mode is ignored : its
+// false colors are made per pixel, after the whole ray. options.runtime
+// is too : only the kernel testing the modes at every sample keeps the
+// sums the fragments need.
+CpuRayPath renderVolumeBoxCPU(const SamplerVolume & volume, const glm::vec3 & boxmin, const glm::vec3 & boxmax,
+                              const glm::mat4 & mvp, const CpuRayOptions & options, int width, int height,
+                              CpuRayFragment * fragments, CpuRayPath path = CPU_RAY_AUTO, int share = 0, int shares = 1);
+
+#endif
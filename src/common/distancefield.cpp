@@ -0,0 +1,109 @@
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "distancefield.hpp"
+#include "parallel.hpp"
+
+// larger than any squared distance inside a 256^3 volume
+static const float DISTANCE_INFINITY = 1e20f;
+
+// 1D squared distance transform of f (n samples, stride apart), in place :
+// f[q] = min over p of (q-p)^2 + f[p]. v, z and d are scratch space for
+// n, n+1 and n values.
+static void distanceTransform1D(float * f, int n, size_t stride, int * v, float * z, float * d){
+	int k = 0;
+	v[0] = 0;
+	z[0] = -DISTANCE_INFINITY;
+	z[1] =  DISTANCE_INFINITY;
+	for (int q = 1; q < n; q++){
+		float fq = f[q*stride];
+		if (fq >= DISTANCE_INFINITY) continue;
+		if (f[v[0]*stride] >= DISTANCE_INFINITY){
+			// first finite sample so far
+			v[0] = q;
+			continue;
+		}
+		// intersection with the rightmost parabola of the envelope
+		// (z[0] is minus infinity, so k never drops below 0)
+		float s;
+		for (;;){
+			int p = v[k];
+			s = ((fq + (float)q*q) - (f[p*stride] + (float)p*p)) / (2.0f*(q - p));
+			if (s > z[k]) break;
+			k--;
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k+1] = DISTANCE_INFINITY;
+	}
+
+	if (f[v[0]*stride] >= DISTANCE_INFINITY) return;
+
+	k = 0;
+	for (int q = 0; q < n; q++){
+		while (z[k+1] < q) k++;
+		float dq = (float)(q - v[k]);
+		d[q] = dq*dq + f[v[k]*stride];
+	}
+	for (int q = 0; q < n; q++)
+		f[q*stride] = d[q];
+}
+
+// squared distance from every voxel to the nearest voxel whose occupancy
+// equals target
+static void squaredDistances(const unsigned char * data, int n, unsigned char threshold, bool target, std::vector<float> & dist){
+	size_t count = (size_t)n*n*n;
+	dist.resize(count);
+	for (size_t i = 0; i < count; i++)
+		dist[i] = ((data[i] > threshold) == target) ? 0.0f : DISTANCE_INFINITY;
+
+	size_t row = n, slab = (size_t)n*n;
+	// one pass per axis, each over independent lines
+	for (int axis = 0; axis < 3; axis++){
+		parallel_for(0, n, [&](int first, int last){
+			std::vector<int> v(n);
+			std::vector<float> z(n+1), d(n);
+			for (int a = first; a < last; a++)
+			for (int b = 0; b < n; b++){
+				float * line;
+				size_t stride;
+				if (axis == 0){
+					line = &dist[a*slab + b*row];
+					stride = 1;
+				} else if (axis == 1){
+					line = &dist[a*slab + b];
+					stride = row;
+				} else {
+					line = &dist[a*row + b];
+					stride = slab;
+				}
+				distanceTransform1D(line, n, stride, &v[0], &z[0], &d[0]);
+			}
+		});
+	}
+}
+
+void buildDistanceField(const unsigned char * data, int n, unsigned char threshold, std::vector<unsigned char> & field){
+	size_t count = (size_t)n*n*n;
+	field.resize(count);
+
+	std::vector<float> outside, inside;
+	squaredDistances(data, n, threshold, true,  outside);
+	squaredDistances(data, n, threshold, false, inside);
+
+	parallel_for(0, n, [&](int first, int last){
+		for (size_t i = (size_t)first*n*n; i < (size_t)last*n*n; i++){
+			// the surface lies half a voxel before the nearest voxel
+			// of the other kind
+			float distance;
+			if (outside[i] > 0.0f)
+				distance = std::max(sqrtf(outside[i]) - 0.5f, 0.0f);
+			else
+				distance = -std::max(sqrtf(inside[i]) - 0.5f, 0.0f);
+			int value = DISTANCE_FIELD_ZERO + (distance >= 0.0f ? (int)floorf(distance) : (int)ceilf(distance));
+			field[i] = (unsigned char)std::max(0, std::min(value, 255));
+		}
+	});
+}
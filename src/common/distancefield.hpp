@@ -0,0 +1,22 @@
+#ifndef DISTANCEFIELD_HPP
+#define DISTANCEFIELD_HPP
+
+#include <vector>
+
+// Texel value of a voxel lying on the surface ; buildDistanceField stores
+// one voxel of distance per step away from it
+#define DISTANCE_FIELD_ZERO 128
+
+// Builds the signed euclidean distance field of the occupied (> threshold)
+// voxels of an n*n*n 8 bit volume, first texture coordinate varying
+// fastest. Distances are exact, measured in voxels from the surface half
+// way between occupied and empty voxel centers : positive outside, negative
+// inside. They are stored as DISTANCE_FIELD_ZERO + distance, rounded
+// towards the surface and clamped to 8 bits, so a ray can always advance
+// by the stored value.
+// Linear time : the squared distance transform is separable, and each
+// axis is done with the lower envelope of parabolas of Felzenszwalb and
+// Huttenlocher, rows in parallel.
+void buildDistanceField(const unsigned char * data, int n, unsigned char threshold, std::vector<unsigned char> & field);
+
+#endif
@@ -0,0 +1,132 @@
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+
+#include "framering.hpp"
+#include "parallel.hpp"
+
+namespace framering{
+
+	enum SlotState{
+		SLOT_FREE,
+		SLOT_FILLING,
+		SLOT_READY,
+		SLOT_TAKEN
+	};
+
+	struct Slot{
+		std::vector<unsigned char> voxels;
+		int frame;
+		SlotState state;
+	};
+
+	static std::vector<Slot> slots;
+	static FrameGenerator generator;
+	static std::vector<std::thread> workers;
+	static std::mutex mutex;
+	static std::condition_variable freed;   // a slot came back, or shutdown
+	static int nextFrame = 0;               // next frame to generate
+	static int nextShown = 0;               // next frame to hand out
+	static int taken = -1;                  // slot of the last acquire
+	static bool stopping = false;
+	static Stats counters;
+	static std::chrono::steady_clock::time_point started;
+
+	static void worker(){
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true){
+			std::vector<Slot>::iterator slot;
+			freed.wait(lock, [&]{
+				slot = std::find_if(slots.begin(), slots.end(), [](const Slot & s){ return s.state == SLOT_FREE; });
+				return stopping || slot != slots.end();
+			});
+			if (stopping) return;
+
+			slot->state = SLOT_FILLING;
+			slot->frame = nextFrame++;
+			lock.unlock();
+			generator(slot->frame, &slot->voxels[0]);
+			lock.lock();
+			slot->state = SLOT_READY;
+			counters.produced++;
+		}
+	}
+
+	void init(size_t frameSize, int capacity, FrameGenerator generate, int threads){
+		shutdown();
+		if (threads <= 0) threads = parallel_threads();
+		capacity = std::max(capacity, 2);
+
+		slots.assign(capacity, Slot());
+		for (auto & slot : slots){
+			slot.voxels.resize(frameSize);
+			slot.frame = -1;
+			slot.state = SLOT_FREE;
+		}
+		generator = generate;
+		nextFrame = nextShown = 0;
+		taken = -1;
+		stopping = false;
+		counters = Stats();
+		counters.capacity = capacity;
+		started = std::chrono::steady_clock::now();
+		for (int i = 0; i < threads; i++)
+			workers.push_back(std::thread(worker));
+	}
+
+	void shutdown(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		freed.notify_all();
+		for (auto & thread : workers)
+			thread.join();
+		workers.clear();
+		slots.clear();
+		generator = FrameGenerator();
+	}
+
+	bool running(){
+		return !workers.empty();
+	}
+
+	const unsigned char * acquire(int & frame){
+		std::lock_guard<std::mutex> lock(mutex);
+		if (slots.empty() || taken >= 0) return NULL;
+		for (size_t i = 0; i < slots.size(); i++){
+			Slot & slot = slots[i];
+			if (slot.state == SLOT_READY && slot.frame == nextShown){
+				slot.state = SLOT_TAKEN;
+				taken = (int)i;
+				frame = nextShown++;
+				counters.consumed++;
+				return &slot.voxels[0];
+			}
+		}
+		counters.stalls++;
+		return NULL;
+	}
+
+	void release(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (taken < 0) return;
+			slots[taken].state = SLOT_FREE;
+			taken = -1;
+		}
+		freed.notify_one();
+	}
+
+	Stats stats(){
+		std::lock_guard<std::mutex> lock(mutex);
+		Stats s = counters;
+		s.ready = (int)std::count_if(slots.begin(), slots.end(), [](const Slot & slot){ return slot.state == SLOT_READY; });
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		s.framesPerSecond = seconds > 0 ? s.produced / seconds : 0;
+		return s;
+	}
+}
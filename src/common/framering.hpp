@@ -0,0 +1,46 @@
+#ifndef FRAMERING_HPP
+#define FRAMERING_HPP
+
+#include <functional>
+#include <cstddef>
+
+// Frames of an animated volume, generated ahead of playback by worker
+// threads into a ring of fixed size. Each worker makes whole frames, so
+// as many frames are in the making as there are workers. The consumer
+// takes them in order and never waits : a frame not ready yet is a stall
+// (the previous one stays on screen), not a pause.
+namespace framering{
+
+	// Fills out (frameSize bytes) with frame number frame. Called on the
+	// worker threads.
+	typedef std::function<void(int frame, unsigned char * out)> FrameGenerator;
+
+	struct Stats{
+		int    capacity;         // frames in the ring
+		int    ready;            // generated, not taken yet
+		long   produced;         // frames generated since init
+		long   consumed;         // frames taken
+		long   stalls;           // acquires that found the next frame not ready
+		double framesPerSecond;  // sustained generation rate since init
+	};
+
+	// Starts generating frames 0, 1, 2, ... into a ring of capacity frames
+	// (0 threads : one per core)
+	void init(size_t frameSize, int capacity, FrameGenerator generate, int threads = 0);
+
+	// Stops the workers, dropping the frames not taken
+	void shutdown();
+
+	bool running();
+
+	// The next frame, in order, or NULL if it is not ready. It stays valid,
+	// and its slot busy, until release().
+	const unsigned char * acquire(int & frame);
+
+	// Gives the frame of the last acquire back to the workers
+	void release();
+
+	Stats stats();
+}
+
+#endif
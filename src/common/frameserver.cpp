@@ -0,0 +1,234 @@
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frameserver.hpp"
+
+namespace frameserver{
+
+	// the slots start on a page boundary after the header
+	#define FRAMESERVER_ALIGNMENT 4096
+
+	// readers and the server share these through the segment : they must
+	// not need a lock
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "64 bit atomics must be lock free in shared memory");
+
+	struct Slot{
+		std::atomic<uint64_t> sequence;     // 2 * frame, or 2 * frame + 1 while written
+		std::atomic<uint64_t> renderedNs;
+	};
+}
+
+struct frameserver::Header{
+	char magic[8];                      // "RFRAME1"
+	uint32_t width, height;
+	uint64_t frameBytes;
+	uint64_t slotsOffset;               // from the start of the segment
+	std::atomic<uint64_t> latest;       // frame << 2 | slot, 0 before the first
+	Slot slots[FRAMESERVER_SLOTS];
+};
+
+namespace frameserver{
+
+	static Header * server = NULL;
+	static size_t serverSize = 0;
+	static std::string serverName;
+	static uint64_t published = 0;
+	static int writing = -1;              // the slot frame() hands out, -1 : none yet
+	static uint64_t openedNs = 0;
+
+	static size_t segmentSize(size_t frameBytes){
+		size_t offset = (sizeof(Header) + FRAMESERVER_ALIGNMENT - 1) / FRAMESERVER_ALIGNMENT * FRAMESERVER_ALIGNMENT;
+		return offset + frameBytes * FRAMESERVER_SLOTS;
+	}
+
+	static unsigned char * slotPixels(Header * header, int slot){
+		return (unsigned char *)header + header->slotsOffset + header->frameBytes * slot;
+	}
+
+	uint64_t monotonicNanoseconds(){
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+	}
+
+	bool open(const std::string & name, int width, int height){
+		close();
+		size_t frameBytes = (size_t)width * height * 4;
+		size_t size = segmentSize(frameBytes);
+
+		// a new segment every time : readers still mapping the old one
+		// keep it whole, where truncating it in place would fault them
+		shm_unlink(name.c_str());
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (fd < 0) return false;
+		void * mapping = MAP_FAILED;
+		if (ftruncate(fd, size) == 0)
+			mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED){
+			shm_unlink(name.c_str());
+			return false;
+		}
+
+		server = (Header *)mapping;
+		serverSize = size;
+		serverName = name;
+		// readers check the magic last
+		memset(server->magic, 0, sizeof(server->magic));
+		server->width = width;
+		server->height = height;
+		server->frameBytes = frameBytes;
+		server->slotsOffset = size - frameBytes * FRAMESERVER_SLOTS;
+		server->latest.store(0);
+		for (int i = 0; i < FRAMESERVER_SLOTS; i++){
+			server->slots[i].sequence.store(0);
+			server->slots[i].renderedNs.store(0);
+		}
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(server->magic, "RFRAME1", 8);
+
+		published = 0;
+		writing = -1;
+		openedNs = monotonicNanoseconds();
+		return true;
+	}
+
+	void close(){
+		if (!server) return;
+		munmap(server, serverSize);
+		shm_unlink(serverName.c_str());
+		server = NULL;
+		serverSize = 0;
+	}
+
+	bool isOpen(){
+		return server != NULL;
+	}
+
+	unsigned char * frame(){
+		if (!server) return NULL;
+		if (writing < 0){
+			// the slot after the latest holds the oldest frame : readers
+			// have had two frames to leave it
+			uint64_t latest = server->latest.load(std::memory_order_relaxed);
+			writing = latest ? (int)((latest & 3) + 1) % FRAMESERVER_SLOTS : 0;
+			server->slots[writing].sequence.store(2 * (published + 1) + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+		return slotPixels(server, writing);
+	}
+
+	void publish(uint64_t renderedNs){
+		if (!server) return;
+		frame();
+		published++;
+		Slot & slot = server->slots[writing];
+		slot.renderedNs.store(renderedNs, std::memory_order_relaxed);
+		slot.sequence.store(2 * published, std::memory_order_release);
+		server->latest.store(published << 2 | writing, std::memory_order_release);
+		writing = -1;
+	}
+
+	Stats stats(){
+		Stats s = Stats();
+		if (!server) return s;
+		s.width = server->width;
+		s.height = server->height;
+		s.published = (long)published;
+		double seconds = (monotonicNanoseconds() - openedNs) * 1e-9;
+		s.framesPerSecond = seconds > 0 ? published / seconds : 0;
+		return s;
+	}
+
+	Reader::Reader() : header(NULL), mappingSize(0), device(0), inode(0), lastSequence(0), lastSlot(-1) {}
+
+	Reader::~Reader(){
+		close();
+	}
+
+	bool Reader::open(const std::string & name){
+		close();
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0) return false;
+		struct stat st;
+		void * mapping = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header))
+			mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapping == MAP_FAILED) return false;
+
+		Header * candidate = (Header *)mapping;
+		bool valid = memcmp(candidate->magic, "RFRAME1", 8) == 0;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (!valid || segmentSize(candidate->frameBytes) > (size_t)st.st_size){
+			munmap(mapping, st.st_size);
+			return false;
+		}
+		header = candidate;
+		mappingSize = st.st_size;
+		segmentName = name;
+		device = st.st_dev;
+		inode = st.st_ino;
+		lastSequence = 0;
+		lastSlot = -1;
+		return true;
+	}
+
+	void Reader::close(){
+		if (!header) return;
+		munmap(header, mappingSize);
+		header = NULL;
+		mappingSize = 0;
+	}
+
+	bool Reader::replaced() const {
+		if (!header) return false;
+		int fd = shm_open(segmentName.c_str(), O_RDONLY, 0);
+		if (fd < 0) return true;
+		struct stat st;
+		bool same = fstat(fd, &st) == 0 && st.st_dev == device && st.st_ino == inode;
+		::close(fd);
+		return !same;
+	}
+
+	int Reader::width() const {
+		return header ? header->width : 0;
+	}
+
+	int Reader::height() const {
+		return header ? header->height : 0;
+	}
+
+	const unsigned char * Reader::acquire(uint64_t & sequence, uint64_t & renderedNs){
+		if (!header) return NULL;
+		// a few tries : the server may move on between the loads
+		for (int attempt = 0; attempt < 4; attempt++){
+			uint64_t latest = header->latest.load(std::memory_order_acquire);
+			uint64_t frame = latest >> 2;
+			int slot = (int)(latest & 3);
+			if (frame == 0 || frame == lastSequence) return NULL;
+			Slot & s = header->slots[slot];
+			if (s.sequence.load(std::memory_order_acquire) != 2 * frame)
+				continue;
+			sequence = frame;
+			renderedNs = s.renderedNs.load(std::memory_order_relaxed);
+			lastSequence = frame;
+			lastSlot = slot;
+			return slotPixels(header, slot);
+		}
+		return NULL;
+	}
+
+	bool Reader::release(){
+		if (!header || lastSlot < 0) return false;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		bool intact = header->slots[lastSlot].sequence.load(std::memory_order_relaxed) == 2 * lastSequence;
+		lastSlot = -1;
+		return intact;
+	}
+}
@@ -0,0 +1,94 @@
+#ifndef FRAMESERVER_HPP
+#define FRAMESERVER_HPP
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Rendered frames published in POSIX shared memory, for recorders,
+// encoders and dashboards on the same machine to read without a second
+// render and without a copy.
+//
+// The segment holds a header and three slots of width*height RGBA pixels,
+// bottom row first. Each frame goes into the slot that is neither the
+// latest one nor the one before it, so the server never waits for a
+// reader. A reader is given two frame times to use the latest frame.
+// Every slot carries a sequence number, odd while the slot is written,
+// so a reader can tell when a slow read was overwritten.
+namespace frameserver{
+
+	#define FRAMESERVER_NAME  "/raycast-frames"
+	#define FRAMESERVER_SLOTS 3
+
+	struct Stats{
+		int    width, height;
+		long   published;
+		double framesPerSecond;   // published since open
+	};
+
+	// Creates the segment name for frames of width*height, in place of
+	// any segment of that name : its readers keep their mapping, and no
+	// more frames (Reader::replaced)
+	bool open(const std::string & name, int width, int height);
+
+	// Removes the segment ; readers attached keep their mapping
+	void close();
+
+	bool isOpen();
+
+	// Where the next frame goes : width*height*4 bytes
+	unsigned char * frame();
+
+	// Makes the frame written to frame() the latest, rendered at
+	// renderedNs on the monotonic clock
+	void publish(uint64_t renderedNs);
+
+	Stats stats();
+
+	// CLOCK_MONOTONIC, the same in every process of the machine
+	uint64_t monotonicNanoseconds();
+
+	// Attaches to the frames of a server, read only
+	class Reader{
+	public:
+		Reader();
+		~Reader();
+
+		bool open(const std::string & name = FRAMESERVER_NAME);
+		void close();
+		bool isOpen() const { return header != NULL; }
+
+		// True if the segment attached to is no longer the one of its
+		// name : the server closed it, or opened a new one. No frame will
+		// come any more ; open again to follow the server. A system call,
+		// for when frames stop coming.
+		bool replaced() const;
+
+		int width() const;
+		int height() const;
+
+		// The latest frame if it is newer than the last one acquired, or
+		// NULL. sequence counts the frames published, from 1 ; renderedNs
+		// is when the frame was rendered.
+		const unsigned char * acquire(uint64_t & sequence, uint64_t & renderedNs);
+
+		// Done with the last frame acquired : false if the server has
+		// written over it meanwhile, and what was read is torn
+		bool release();
+
+	private:
+		Reader(const Reader &);
+		Reader & operator=(const Reader &);
+
+		struct Header * header;
+		size_t mappingSize;
+		std::string segmentName;
+		dev_t device;
+		ino_t inode;
+		uint64_t lastSequence;
+		int lastSlot;
+	};
+}
+
+#endif
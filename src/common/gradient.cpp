@@ -0,0 +1,66 @@
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "gradient.hpp"
+#include "parallel.hpp"
+
+// row (t,r) of the volume as n consecutive bytes : in place for the
+// linear layout, copied into buffer for the others
+template<class Layout>
+static const unsigned char * layoutRow(const unsigned char * data, const Layout & layout, int n, int t, int r, unsigned char * buffer){
+	for (int s = 0; s < n; s++)
+		buffer[s] = data[layout.index(s, t, r)];
+	return buffer;
+}
+
+static const unsigned char * layoutRow(const unsigned char * data, const LinearLayout & layout, int, int t, int r, unsigned char *){
+	return data + layout.index(0, t, r);
+}
+
+template<class Layout>
+void buildGradientVolume(const unsigned char * data, const Layout & layout, int n, std::vector<unsigned char> & gradients){
+	gradients.resize((size_t)n*n*n*4);
+	if (n < 2){
+		std::fill(gradients.begin(), gradients.end(), 127);
+		return;
+	}
+
+	parallel_for(0, n, [&](int first, int last){
+		std::vector<float> gs(n), gt(n), gr(n);
+		std::vector<unsigned char> rows(5*n);
+
+		for (int r = first; r < last; r++)
+		for (int t = 0; t < n; t++){
+			// neighbour rows, clamped at the border ; one sided
+			// differences there, halved like the central ones
+			int r0 = std::max(r-1, 0), r1 = std::min(r+1, n-1);
+			int t0 = std::max(t-1, 0), t1 = std::min(t+1, n-1);
+			const unsigned char * row   = layoutRow(data, layout, n, t,  r,  &rows[0]);
+			const unsigned char * prevt = layoutRow(data, layout, n, t0, r,  &rows[n]);
+			const unsigned char * nextt = layoutRow(data, layout, n, t1, r,  &rows[2*n]);
+			const unsigned char * prevr = layoutRow(data, layout, n, t,  r0, &rows[3*n]);
+			const unsigned char * nextr = layoutRow(data, layout, n, t,  r1, &rows[4*n]);
+			float scale_t = 1.0f / (t1 - t0);
+			float scale_r = 1.0f / (r1 - r0);
+
+			// straight loops over the row, no branches : these vectorize
+			gs[0]   = (float)row[1]   - row[0];
+			gs[n-1] = (float)row[n-1] - row[n-2];
+			for (int s = 1; s < n-1; s++)
+				gs[s] = 0.5f * ((float)row[s+1] - row[s-1]);
+			for (int s = 0; s < n; s++){
+				gt[s] = scale_t * ((float)nextt[s] - prevt[s]);
+				gr[s] = scale_r * ((float)nextr[s] - prevr[s]);
+			}
+
+			unsigned char * out = &gradients[(((size_t)r*n + t)*n)*4];
+			for (int s = 0; s < n; s++)
+				packGradient(gs[s], gt[s], gr[s], out + 4*s);
+		}
+	});
+}
+
+template void buildGradientVolume(const unsigned char *, const LinearLayout &, int, std::vector<unsigned char> &);
+template void buildGradientVolume(const unsigned char *, const BrickedLayout<4> &, int, std::vector<unsigned char> &);
+template void buildGradientVolume(const unsigned char *, const BrickedLayout<8> &, int, std::vector<unsigned char> &);
@@ -0,0 +1,335 @@
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "marchingcubes.hpp"
+#include "parallel.hpp"
+
+// Cube corners are numbered by their offset bits : bit k set means one
+// voxel further along texture axis k (s, t, r). Edge axis*4+j runs along
+// axis from the corner whose other two bits, lowest axis first, are j.
+
+static const unsigned int NO_VERTEX = ~0u;
+// marks the indices of a slab that refer to its loop centers
+static const unsigned int CENTER = 1u << 31;
+
+// Triangles of one of the 256 cases, as vertex triples : 0-11 are the
+// vertices on the edges, 12+k the center of the k-th fanned loop, whose
+// edges are loops[loopStart[k]] to loops[loopStart[k+1]]
+struct CubeCase{
+	int count;
+	signed char edges[36];
+	int centers;
+	signed char loopStart[4];
+	signed char loops[12];
+};
+
+static int edgeBetween(int c0, int c1){
+	int diff = c0 ^ c1;
+	int axis = diff == 1 ? 0 : diff == 2 ? 1 : 2;
+	int base = std::min(c0, c1);
+	int o0 = axis == 0 ? 1 : 0;
+	int o1 = axis == 2 ? 1 : 2;
+	return axis*4 + ((base >> o0) & 1) + 2*((base >> o1) & 1);
+}
+
+// Derives the triangulation of every case instead of tabulating it : on
+// each face the contour pieces are found going round the face counter
+// clockwise (seen from outside), pairing every crossing from inside to
+// outside with the next crossing back. Ambiguous faces thus always
+// connect their outside corners, and as both cubes sharing a face see
+// the same pairing the surface has no holes. The pieces chain into
+// loops around the cube. A loop of three edges is one triangle ; longer
+// ones are fanned around a vertex added at their center. Fanning from
+// one of their own vertices would put triangles, or edges, into the cube
+// faces, where the neighbor cube can make the same ones and the surface
+// would no longer be a manifold.
+static void buildCases(CubeCase * cases){
+	for (int config = 0; config < 256; config++){
+		int next[12];
+		for (int e = 0; e < 12; e++) next[e] = -1;
+
+		for (int axis = 0; axis < 3; axis++)
+		for (int side = 0; side < 2; side++){
+			int u = (axis+1) % 3, v = (axis+2) % 3;
+			int ring[4] = {0, 1 << u, (1 << u) | (1 << v), 1 << v};
+			if (!side) std::swap(ring[1], ring[3]);
+			for (int i = 0; i < 4; i++) ring[i] |= side << axis;
+
+			int edge[4];
+			bool exits[4], enters[4];
+			for (int i = 0; i < 4; i++){
+				bool in0 = (config >> ring[i]) & 1;
+				bool in1 = (config >> ring[(i+1) % 4]) & 1;
+				edge[i] = edgeBetween(ring[i], ring[(i+1) % 4]);
+				exits[i]  =  in0 && !in1;
+				enters[i] = !in0 &&  in1;
+			}
+			for (int i = 0; i < 4; i++){
+				if (!exits[i]) continue;
+				int k = (i+1) % 4;
+				while (!enters[k]) k = (k+1) % 4;
+				next[edge[i]] = edge[k];
+			}
+		}
+
+		CubeCase & c = cases[config];
+		c.count = 0;
+		c.centers = 0;
+		c.loopStart[0] = 0;
+		bool used[12] = {false};
+		for (int start = 0; start < 12; start++){
+			if (next[start] < 0 || used[start]) continue;
+			int loop[12], length = 0;
+			for (int e = start; !used[e]; e = next[e]){
+				used[e] = true;
+				loop[length++] = e;
+			}
+			if (length == 3){
+				c.edges[3*c.count+0] = loop[0];
+				c.edges[3*c.count+1] = loop[2];
+				c.edges[3*c.count+2] = loop[1];
+				c.count++;
+				continue;
+			}
+			for (int i = 0; i < length; i++){
+				c.edges[3*c.count+0] = 12 + c.centers;
+				c.edges[3*c.count+1] = loop[(i+1) % length];
+				c.edges[3*c.count+2] = loop[i];
+				c.count++;
+				c.loops[c.loopStart[c.centers] + i] = loop[i];
+			}
+			c.centers++;
+			c.loopStart[c.centers] = c.loopStart[c.centers-1] + length;
+		}
+	}
+}
+
+static const CubeCase * cubeCases(){
+	static CubeCase cases[256];
+	static bool built = (buildCases(cases), true);
+	(void)built;
+	return cases;
+}
+
+// Vertices and triangles of the cubes in layers [first,last) ; the
+// vertices on plane last come at the end, from top on. The loop centers
+// are kept apart, as they are made while the top plane is already out.
+struct Slab{
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec3> centers;
+	std::vector<glm::vec3> centerNormals;
+	std::vector<unsigned int> indices;
+	size_t top;
+};
+
+namespace {
+struct Extractor{
+	const unsigned char * data;
+	int n;
+	float iso;
+
+	float value(int r, int t, int s) const {
+		return data[((size_t)r*n + t)*n + s];
+	}
+
+	// density gradient at a voxel, in (s,t,r) order
+	glm::vec3 gradient(int r, int t, int s) const {
+		int s0 = std::max(s-1, 0), s1 = std::min(s+1, n-1);
+		int t0 = std::max(t-1, 0), t1 = std::min(t+1, n-1);
+		int r0 = std::max(r-1, 0), r1 = std::min(r+1, n-1);
+		return glm::vec3(
+			(value(r, t, s1) - value(r, t, s0)) / (s1 - s0),
+			(value(r, t1, s) - value(r, t0, s)) / (t1 - t0),
+			(value(r1, t, s) - value(r0, t, s)) / (r1 - r0));
+	}
+
+	// adds the vertex on the edge from voxel (r,t,s) one step along axis,
+	// if the surface crosses it
+	unsigned int edgeVertex(Slab & slab, int r, int t, int s, int axis) const {
+		int r1 = r + (axis == 2), t1 = t + (axis == 1), s1 = s + (axis == 0);
+		float v0 = value(r, t, s), v1 = value(r1, t1, s1);
+		if ((v0 > iso) == (v1 > iso)) return NO_VERTEX;
+
+		float f = (iso - v0) / (v1 - v0);
+		glm::vec3 p0((s  + 0.5f) / n, (t  + 0.5f) / n, (r  + 0.5f) / n);
+		glm::vec3 p1((s1 + 0.5f) / n, (t1 + 0.5f) / n, (r1 + 0.5f) / n);
+		glm::vec3 g = gradient(r, t, s) * (1-f) + gradient(r1, t1, s1) * f;
+		float length = glm::length(g);
+
+		slab.vertices.push_back(p0 + (p1 - p0) * f);
+		slab.normals.push_back(length > 0 ? -g / length : glm::vec3(0.0f));
+		return (unsigned int)(slab.vertices.size() - 1);
+	}
+
+	// vertices on the edges lying within plane r, in scan order : two
+	// slabs sharing the plane number them the same way
+	void planeVertices(Slab & slab, int r, std::vector<unsigned int> & plane) const {
+		for (int t = 0; t < n; t++)
+		for (int s = 0; s < n; s++){
+			plane[2*(t*n+s)+0] = s+1 < n ? edgeVertex(slab, r, t, s, 0) : NO_VERTEX;
+			plane[2*(t*n+s)+1] = t+1 < n ? edgeVertex(slab, r, t, s, 1) : NO_VERTEX;
+		}
+	}
+
+	void extract(Slab & slab, int first, int last) const {
+		const CubeCase * cases = cubeCases();
+		std::vector<unsigned int> below(2*n*n), above(2*n*n), across(n*n);
+
+		planeVertices(slab, first, below);
+		for (int r = first; r < last; r++){
+			for (int t = 0; t < n; t++)
+			for (int s = 0; s < n; s++)
+				across[t*n+s] = edgeVertex(slab, r, t, s, 2);
+			if (r+1 == last) slab.top = slab.vertices.size();
+			planeVertices(slab, r+1, above);
+
+			for (int t = 0; t+1 < n; t++)
+			for (int s = 0; s+1 < n; s++){
+				int config = 0;
+				for (int corner = 0; corner < 8; corner++)
+					if (value(r + ((corner >> 2) & 1), t + ((corner >> 1) & 1), s + (corner & 1)) > iso)
+						config |= 1 << corner;
+				const CubeCase & c = cases[config];
+				if (!c.count) continue;
+
+				unsigned int vertex[15];
+				for (int j = 0; j < 4; j++){
+					int dt = j & 1, dr = j >> 1, ds = j & 1;
+					// along s : j picks (t, r), along t : (s, r), along r : (s, t)
+					vertex[0+j] = (dr ? above : below)[2*((t+dt)*n + s)+0];
+					vertex[4+j] = (dr ? above : below)[2*(t*n + s+ds)+1];
+					vertex[8+j] = across[(t + (j >> 1))*n + s + (j & 1)];
+				}
+				for (int k = 0; k < c.centers; k++){
+					glm::vec3 position(0.0f), normal(0.0f);
+					for (int i = c.loopStart[k]; i < c.loopStart[k+1]; i++){
+						position += slab.vertices[vertex[(int)c.loops[i]]];
+						normal   += slab.normals [vertex[(int)c.loops[i]]];
+					}
+					float length = glm::length(normal);
+					slab.centers.push_back(position / (float)(c.loopStart[k+1] - c.loopStart[k]));
+					slab.centerNormals.push_back(length > 0 ? normal / length : glm::vec3(0.0f));
+					vertex[12+k] = CENTER | (unsigned int)(slab.centers.size() - 1);
+				}
+				for (int i = 0; i < 3*c.count; i++)
+					slab.indices.push_back(vertex[(int)c.edges[i]]);
+			}
+			std::swap(below, above);
+		}
+	}
+};
+}
+
+void extractIsosurface(
+	const unsigned char * data, int n, float iso,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	out_indices.clear();
+	out_vertices.clear();
+	out_uvs.clear();
+	out_normals.clear();
+	if (n < 2) return;
+
+	Extractor extractor = {data, n, iso};
+	int layers = n - 1;
+	int count = std::min(parallel_threads(), layers);
+	std::vector<Slab> slabs(count);
+	parallel_chunks(0, layers, count, [&](int first, int last, int chunk){
+		extractor.extract(slabs[chunk], first, last);
+	});
+
+	// the top plane of a slab is the bottom plane of the next one : only
+	// the last slab keeps its own copy. Each slab's loop centers follow
+	// its vertices.
+	std::vector<size_t> vertexOffset(count+1), indexOffset(count+1);
+	for (int i = 0; i < count; i++){
+		size_t kept = i+1 < count ? slabs[i].top : slabs[i].vertices.size();
+		vertexOffset[i+1] = vertexOffset[i] + kept + slabs[i].centers.size();
+		indexOffset[i+1]  = indexOffset[i]  + slabs[i].indices.size();
+	}
+	out_vertices.resize(vertexOffset[count]);
+	out_uvs     .resize(vertexOffset[count]);
+	out_normals .resize(vertexOffset[count]);
+	out_indices .resize(indexOffset[count]);
+
+	parallel_chunks(0, count, count, [&](int first, int last, int){
+		for (int i = first; i < last; i++){
+			const Slab & slab = slabs[i];
+			size_t kept = vertexOffset[i+1] - vertexOffset[i] - slab.centers.size();
+			for (size_t v = 0; v < kept; v++){
+				out_vertices[vertexOffset[i] + v] = slab.vertices[v];
+				out_uvs     [vertexOffset[i] + v] = glm::vec2(slab.vertices[v]);
+				out_normals [vertexOffset[i] + v] = slab.normals[v];
+			}
+			for (size_t v = 0; v < slab.centers.size(); v++){
+				out_vertices[vertexOffset[i] + kept + v] = slab.centers[v];
+				out_uvs     [vertexOffset[i] + kept + v] = glm::vec2(slab.centers[v]);
+				out_normals [vertexOffset[i] + kept + v] = slab.centerNormals[v];
+			}
+			for (size_t k = 0; k < slab.indices.size(); k++){
+				unsigned int v = slab.indices[k];
+				out_indices[indexOffset[i] + k] = v & CENTER ? (unsigned int)(vertexOffset[i] + kept + (v & ~CENTER))
+				                                : v < kept   ? (unsigned int)(vertexOffset[i] + v)
+				                                             : (unsigned int)(vertexOffset[i+1] + (v - slab.top));
+			}
+		}
+	});
+}
+
+size_t countNonManifoldEdges(const std::vector<unsigned int> & indices){
+	std::vector<std::pair<unsigned int, unsigned int> > edges;
+	edges.reserve(indices.size());
+	for (size_t i = 0; i+2 < indices.size(); i += 3)
+	for (int k = 0; k < 3; k++){
+		unsigned int a = indices[i+k], b = indices[i+(k+1)%3];
+		edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+	}
+	std::sort(edges.begin(), edges.end());
+	size_t bad = 0;
+	for (size_t i = 0; i < edges.size(); ){
+		size_t j = i;
+		while (j < edges.size() && edges[j] == edges[i]) j++;
+		bad += j - i != 2;
+		i = j;
+	}
+	return bad;
+}
+
+size_t validateIsosurface(int n, int volumes){
+	std::vector<unsigned int> indices;
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	size_t bad = 0;
+
+	// each case alone, as the middle cube of a 4^3 volume
+	std::vector<unsigned char> cube(64, 0);
+	for (int config = 0; config < 256; config++){
+		for (int corner = 0; corner < 8; corner++)
+			cube[(((corner >> 2) & 1) + 1)*16 + (((corner >> 1) & 1) + 1)*4 + (corner & 1) + 1] = (config >> corner) & 1 ? 255 : 0;
+		extractIsosurface(&cube[0], 4, 127.5f, indices, vertices, uvs, normals);
+		bad += countNonManifoldEdges(indices);
+	}
+
+	// random volumes, with an empty border so that the surface is closed
+	std::vector<unsigned char> volume((size_t)n*n*n);
+	srand(1);
+	for (int i = 0; i < volumes; i++){
+		for (int r = 0; r < n; r++)
+		for (int t = 0; t < n; t++)
+		for (int s = 0; s < n; s++){
+			bool border = !r || !t || !s || r == n-1 || t == n-1 || s == n-1;
+			volume[((size_t)r*n + t)*n + s] = border ? 0 : rand() % 256;
+		}
+		extractIsosurface(&volume[0], n, 127.5f, indices, vertices, uvs, normals);
+		bad += countNonManifoldEdges(indices);
+	}
+	return bad;
+}
@@ -0,0 +1,34 @@
+#ifndef MARCHINGCUBES_HPP
+#define MARCHINGCUBES_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Extracts the isosurface value == iso of an n*n*n 8 bit volume, first
+// texture coordinate varying fastest, as an indexed triangle mesh. The
+// output matches what indexVBO produces, with 32 bit indices since large
+// volumes easily exceed 65536 vertices : positions in texture coordinates
+// ([0,1]^3, voxel centers at (i+0.5)/n), uvs taken from (s,t), and
+// normals from the density gradient, pointing away from the dense side.
+// Triangles are counter clockwise seen from outside. Within the volume
+// the mesh is a closed manifold : every edge belongs to two triangles.
+// The volume is cut into slabs extracted in parallel. Each vertex is
+// created once, through caches indexed by the voxel edge it lies on, and
+// the slabs are stitched by their shared planes once all are done.
+void extractIsosurface(
+	const unsigned char * data, int n, float iso,
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+// Number of edges of an indexed triangle mesh not shared by exactly two
+// of its triangles
+size_t countNonManifoldEdges(const std::vector<unsigned int> & indices);
+
+// Extracts every cube case alone, then volumes random n^3 volumes with an
+// empty border, and returns the number of non manifold edges found.
+size_t validateIsosurface(int n, int volumes);
+
+#endif
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "mipmap.hpp"
+#include "parallel.hpp"
+
+int formatComponents(GLenum format){
+	switch (format){
+	case GL_RGBA:
+	case GL_BGRA:            return 4;
+	case GL_RGB:
+	case GL_BGR:             return 3;
+	case GL_LUMINANCE_ALPHA: return 2;
+	default:                 return 1;
+	}
+}
+
+// Filter taps for halving one axis : output sample i is the weighted
+// sum of input samples 2*i + first .. 2*i + first + taps - 1
+struct MipKernel{
+	int first;
+	std::vector<float> weights;
+};
+
+static double bessel_i0(double x){
+	double sum = 1, term = 1;
+	for (int k = 1; k < 20; k++){
+		term *= (x / (2*k)) * (x / (2*k));
+		sum += term;
+	}
+	return sum;
+}
+
+static MipKernel makeKernel(MipFilter filter){
+	MipKernel kernel;
+	if (filter == MIP_BOX){
+		kernel.first = 0;
+		kernel.weights.push_back(0.5f);
+		kernel.weights.push_back(0.5f);
+		return kernel;
+	}
+
+	// half-band sinc under a Kaiser window, centered between the two
+	// input samples that a box filter would average
+	const int taps = 8;
+	const double alpha = 4.0;
+	const double radius = taps / 2.0;
+	kernel.first = -taps/2 + 1;
+	double sum = 0;
+	for (int t = 0; t < taps; t++){
+		double x = (kernel.first + t) - 0.5;
+		double sinc = (x == 0) ? 1.0 : sin(M_PI * x / 2) / (M_PI * x / 2);
+		double r = x / radius;
+		double window = (fabs(r) < 1) ? bessel_i0(alpha * sqrt(1 - r*r)) / bessel_i0(alpha) : 0;
+		kernel.weights.push_back((float)(sinc * window));
+		sum += sinc * window;
+	}
+	for (int t = 0; t < taps; t++)
+		kernel.weights[t] /= (float)sum;
+	return kernel;
+}
+
+// Halves one axis of a float image of size w x h x d with c components.
+// axis 0 is the fastest varying one. Works on whole rows so the
+// inner loops run over contiguous memory and vectorize.
+static void downsampleAxis(const std::vector<float> & in, std::vector<float> & out,
+                           int w, int h, int d, int c, int axis, const MipKernel & kernel){
+	int size[3] = {w, h, d};
+	int n = size[axis];
+	int half = std::max(1, n / 2);
+	int outsize[3] = {w, h, d};
+	outsize[axis] = half;
+	out.assign((size_t)outsize[0] * outsize[1] * outsize[2] * c, 0.0f);
+
+	int taps = kernel.weights.size();
+	size_t row = (size_t)w * c;             // floats in one input row
+	size_t outrow = (size_t)outsize[0] * c;
+
+	if (axis == 0){
+		parallel_for(0, d * h, [&](int first, int last){
+			for (int line = first; line < last; line++){
+				const float * src = &in[line * row];
+				float * dst = &out[line * outrow];
+				for (int i = 0; i < half; i++){
+					for (int t = 0; t < taps; t++){
+						int x = std::min(std::max(2*i + kernel.first + t, 0), n - 1);
+						float weight = kernel.weights[t];
+						for (int k = 0; k < c; k++)
+							dst[i*c + k] += weight * src[x*c + k];
+					}
+				}
+			}
+		});
+	} else if (axis == 1){
+		parallel_for(0, d * half, [&](int first, int last){
+			for (int line = first; line < last; line++){
+				int z = line / half;
+				int i = line % half;
+				float * dst = &out[(size_t)line * outrow];
+				for (int t = 0; t < taps; t++){
+					int y = std::min(std::max(2*i + kernel.first + t, 0), n - 1);
+					const float * src = &in[((size_t)z * h + y) * row];
+					float weight = kernel.weights[t];
+					for (size_t k = 0; k < row; k++)
+						dst[k] += weight * src[k];
+				}
+			}
+		});
+	} else {
+		size_t slice = row * h;
+		parallel_for(0, half, [&](int first, int last){
+			for (int i = first; i < last; i++){
+				float * dst = &out[i * slice];
+				for (int t = 0; t < taps; t++){
+					int z = std::min(std::max(2*i + kernel.first + t, 0), n - 1);
+					const float * src = &in[z * slice];
+					float weight = kernel.weights[t];
+					for (size_t k = 0; k < slice; k++)
+						dst[k] += weight * src[k];
+				}
+			}
+		});
+	}
+}
+
+void buildMipmaps(TextureData & texture, MipFilter filter){
+	if (texture.format == 0 || texture.levels.size() != 1 || texture.mapping){
+		printf("buildMipmaps : only single level, uncompressed images in memory are supported\n");
+		return;
+	}
+
+	MipKernel kernel = makeKernel(filter);
+	int c = formatComponents(texture.format);
+	int w = texture.levels[0].width;
+	int h = texture.levels[0].height;
+	int d = texture.levels[0].depth;
+
+	std::vector<float> current(texture.storage.begin(), texture.storage.begin() + texture.levels[0].size);
+	std::vector<float> scratch;
+
+	while (w > 1 || h > 1 || d > 1){
+		// separable : one pass per axis that still has something to halve
+		if (w > 1){ downsampleAxis(current, scratch, w, h, d, c, 0, kernel); current.swap(scratch); w /= 2; }
+		if (h > 1){ downsampleAxis(current, scratch, w, h, d, c, 1, kernel); current.swap(scratch); h /= 2; }
+		if (d > 1){ downsampleAxis(current, scratch, w, h, d, c, 2, kernel); current.swap(scratch); d /= 2; }
+
+		TextureLevel level = {(unsigned int)w, (unsigned int)h, (unsigned int)d, texture.storage.size(), current.size()};
+		texture.levels.push_back(level);
+		size_t offset = texture.storage.size();
+		texture.storage.resize(offset + current.size());
+		unsigned char * dst = &texture.storage[offset];
+		for (size_t i = 0; i < current.size(); i++)
+			dst[i] = (unsigned char)std::min(std::max(current[i] + 0.5f, 0.0f), 255.0f);
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef MIPMAP_HPP
+#define MIPMAP_HPP
+
+// Reconstruction filter used between two mip levels
+enum MipFilter{
+	MIP_BOX,     // 2 taps per axis, cheapest
+	MIP_KAISER   // 8 taps per axis, Kaiser windowed sinc : sharper, less aliasing
+};
+
+// Number of 8 bit components per pixel of an uncompressed GL format
+int formatComponents(GLenum format);
+
+// Replaces the single level of an uncompressed 2D or 3D image by its
+// complete mip chain, down to 1x1(x1). The filter is separable and each
+// pass is split across the available cores, slab by slab.
+void buildMipmaps(TextureData & texture, MipFilter filter = MIP_BOX);
+
+#endif
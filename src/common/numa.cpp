@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include "numa.hpp"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define NUMA_LINUX
+#endif
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+#ifdef NUMA_LINUX
+
+// from linux/mempolicy.h
+#define NUMA_MPOL_BIND       2
+#define NUMA_MPOL_INTERLEAVE 3
+
+// The nodes and their cores, read once from sysfs
+struct NumaTopology{
+	std::vector<int> cpus;    // every core, node by node
+	std::vector<int> nodeOf;  // node of cpus[i]
+	int nodes;
+
+	NumaTopology() : nodes(0){
+		for (int node = 0; node < 1024; node++){
+			char path[64];
+			sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+			FILE * file = fopen(path, "r");
+			if (!file) break;
+			// ranges such as 0-7,16-23
+			int first, last;
+			char separator;
+			while (fscanf(file, "%d", &first) == 1){
+				last = first;
+				if (fscanf(file, "%c", &separator) == 1 && separator == '-'){
+					if (fscanf(file, "%d", &last) != 1) break;
+					if (fscanf(file, "%c", &separator) != 1) separator = 0;
+				}
+				for (int cpu = first; cpu <= last; cpu++){
+					cpus.push_back(cpu);
+					nodeOf.push_back(nodes);
+				}
+				if (separator != ',') break;
+			}
+			fclose(file);
+			nodes++;
+		}
+		if (nodes == 0) nodes = 1;
+	}
+};
+
+static const NumaTopology & topology(){
+	static NumaTopology topology;
+	return topology;
+}
+
+int numaNodes(){
+	return topology().nodes;
+}
+
+void * numaAllocate(size_t bytes, NumaPolicy policy, int node){
+	if (bytes < NUMA_LARGE_ALLOCATION)
+		return malloc(bytes ? bytes : 1);
+
+	// map a huge page more than asked and trim to huge page alignment, so
+	// the whole buffer can be backed by huge pages
+	size_t size = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	char * mapping = (char *)mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) return NULL;
+	char * memory = (char *)(((size_t)mapping + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+	if (memory > mapping) munmap(mapping, memory - mapping);
+	if (mapping + HUGE_PAGE_SIZE > memory) munmap(memory + size, mapping + HUGE_PAGE_SIZE - memory);
+
+#ifdef MADV_HUGEPAGE
+	madvise(memory, size, MADV_HUGEPAGE);
+#endif
+	// nothing is touched yet : the policy decides where every page lands
+	// when first written, whichever thread writes it
+	int nodes = numaNodes();
+	if (nodes > 1 && nodes <= 64){
+		unsigned long mask = policy == NUMA_INTERLEAVE ? (nodes == 64 ? ~0UL : (1UL << nodes) - 1) : 1UL << (node % nodes);
+		int mode = policy == NUMA_INTERLEAVE ? NUMA_MPOL_INTERLEAVE : NUMA_MPOL_BIND;
+		// a failure only costs the placement
+		syscall(SYS_mbind, memory, size, mode, &mask, sizeof(mask) * 8, 0);
+	}
+	return memory;
+}
+
+void numaFree(void * memory, size_t bytes){
+	if (!memory) return;
+	if (bytes < NUMA_LARGE_ALLOCATION){
+		free(memory);
+		return;
+	}
+	munmap(memory, (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+}
+
+NumaPin::NumaPin(int worker, int workers) : pinnedNode(0), pinned(false){
+	const NumaTopology & numa = topology();
+	if (numa.nodes < 2 || numa.cpus.empty() || workers < 1) return;
+
+	previous.resize(sizeof(cpu_set_t));
+	if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), (cpu_set_t *)&previous[0]) != 0) return;
+	// spread evenly over the cores, node by node
+	size_t index = (size_t)worker * numa.cpus.size() / workers;
+	index = std::min(index, numa.cpus.size() - 1);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(numa.cpus[index], &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) return;
+	pinned = true;
+	pinnedNode = numa.nodeOf[index];
+}
+
+NumaPin::~NumaPin(){
+	if (pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), (const cpu_set_t *)&previous[0]);
+}
+
+#else
+
+int numaNodes(){
+	return 1;
+}
+
+void * numaAllocate(size_t bytes, NumaPolicy, int){
+	return malloc(bytes ? bytes : 1);
+}
+
+void numaFree(void * memory, size_t){
+	free(memory);
+}
+
+NumaPin::NumaPin(int, int) : pinnedNode(0), pinned(false) {}
+NumaPin::~NumaPin() {}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <new>
+#include <vector>
+#include <cstddef>
+#include <cstdlib>
+#include <type_traits>
+
+// Memory and thread placement on machines with several NUMA nodes (one
+// per socket). Linux only, with the raw system calls : no libnuma. On
+// other systems, or with a single node, everything degrades to plain
+// allocations and unpinned threads.
+
+// Number of NUMA nodes, 1 where unknown
+int numaNodes();
+
+enum NumaPolicy{
+	NUMA_INTERLEAVE,   // pages spread round robin over every node : all
+	                   // cores see the same average distance
+	NUMA_BIND          // pages on one node only
+};
+
+// Allocations from this size on get their own mapping : placed by policy,
+// aligned to and backed by transparent huge pages. Smaller ones come from
+// the heap.
+#define NUMA_LARGE_ALLOCATION (1 << 20)
+
+void * numaAllocate(size_t bytes, NumaPolicy policy = NUMA_INTERLEAVE, int node = 0);
+void numaFree(void * memory, size_t bytes);
+
+// std allocator over numaAllocate, for the buffers of whole volumes.
+// Interleaved unless given a node. The placement moves with the buffer
+// when swapped or moved ; a copy is placed as its destination says.
+template<class T>
+struct NumaAllocator{
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+	NumaPolicy policy;
+	int node;
+
+	NumaAllocator() : policy(NUMA_INTERLEAVE), node(0) {}
+	explicit NumaAllocator(int node) : policy(NUMA_BIND), node(node) {}
+	template<class U> NumaAllocator(const NumaAllocator<U> & other) : policy(other.policy), node(other.node) {}
+	template<class U> struct rebind { typedef NumaAllocator<U> other; };
+
+	T * allocate(size_t count){
+		void * memory = numaAllocate(count * sizeof(T), policy, node);
+		if (!memory) throw std::bad_alloc();
+		return (T *)memory;
+	}
+	void deallocate(T * memory, size_t count){ numaFree(memory, count * sizeof(T)); }
+};
+
+template<class T, class U>
+bool operator==(const NumaAllocator<T> & a, const NumaAllocator<U> & b){ return a.policy == b.policy && a.node == b.node; }
+template<class T, class U>
+bool operator!=(const NumaAllocator<T> & a, const NumaAllocator<U> & b){ return !(a == b); }
+
+typedef std::vector<unsigned char, NumaAllocator<unsigned char> > NumaBytes;
+
+// Pins the calling thread, worker worker of workers, for its lifetime :
+// workers fill the cores of node 0 first, then node 1 and so on, so
+// consecutive workers (and the consecutive rows of tiles parallel_chunks
+// gives them) share a node. The previous affinity comes back with the
+// destructor. Does nothing on a single node.
+class NumaPin{
+public:
+	NumaPin(int worker, int workers);
+	~NumaPin();
+	int node() const { return pinnedNode; }  // where the thread runs, 0 if not pinned
+private:
+	NumaPin(const NumaPin &);
+	NumaPin & operator=(const NumaPin &);
+	int pinnedNode;
+	bool pinned;
+	std::vector<unsigned char> previous;   // cpu_set_t, kept opaque
+};
+
+#endif
@@ -98,3 +98,36 @@ bool loadOBJ(
 
 	return true;
 }
+
+
+bool saveOBJ(
+	const char * path,
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals
+){
+	FILE * file = fopen(path, "w");
+	if( file == NULL ){
+		printf("Impossible to open %s for writing\n", path);
+		return false;
+	}
+
+	for( unsigned int i=0; i<vertices.size(); i++ )
+		fprintf(file, "v %f %f %f\n", vertices[i].x, vertices[i].y, vertices[i].z);
+	// loadOBJ inverts V
+	for( unsigned int i=0; i<uvs.size(); i++ )
+		fprintf(file, "vt %f %f\n", uvs[i].x, -uvs[i].y);
+	for( unsigned int i=0; i<normals.size(); i++ )
+		fprintf(file, "vn %f %f %f\n", normals[i].x, normals[i].y, normals[i].z);
+	// same index for all three attributes, starting at 1
+	for( unsigned int i=0; i+2<indices.size(); i+=3 )
+		fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n",
+			indices[i  ]+1, indices[i  ]+1, indices[i  ]+1,
+			indices[i+1]+1, indices[i+1]+1, indices[i+1]+1,
+			indices[i+2]+1, indices[i+2]+1, indices[i+2]+1);
+
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
\ No newline at end of file
@@ -8,4 +8,14 @@ bool loadOBJ(
 	std::vector<glm::vec3> & out_normals
 );
 
-#endif
\ No newline at end of file
+// Writes an indexed mesh, as produced by indexVBO or extractIsosurface,
+// in a form loadOBJ reads back
+bool saveOBJ(
+	const char * path,
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals
+);
+
+#endif
\ No newline at end of file
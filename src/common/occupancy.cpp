@@ -0,0 +1,71 @@
+#include <vector>
+#include <algorithm>
+
+#include "occupancy.hpp"
+#include "parallel.hpp"
+
+void buildProxyBoxes(const unsigned char * data, int n, int brick, std::vector<ProxyBox> & boxes){
+	boxes.clear();
+	brick = std::max(1, std::min(brick, n));
+	int bricks = (n + brick - 1) / brick;
+
+	// 1. occupancy of every brick, one slab of bricks per task. Bricks
+	// are grown by one voxel : linear filtering reaches that far.
+	std::vector<char> occupied(bricks * bricks * bricks, 0);
+	parallel_for(0, bricks, [&](int first, int last){
+		for (int br = first; br < last; br++)
+		for (int bt = 0; bt < bricks; bt++)
+		for (int bs = 0; bs < bricks; bs++){
+			int r0 = std::max(br*brick - 1, 0), r1 = std::min((br+1)*brick + 1, n);
+			int t0 = std::max(bt*brick - 1, 0), t1 = std::min((bt+1)*brick + 1, n);
+			int s0 = std::max(bs*brick - 1, 0), s1 = std::min((bs+1)*brick + 1, n);
+			bool found = false;
+			for (int r = r0; r < r1 && !found; r++)
+			for (int t = t0; t < t1 && !found; t++){
+				const unsigned char * row = data + ((size_t)r*n + t)*n;
+				for (int s = s0; s < s1; s++)
+					if (row[s]){ found = true; break; }
+			}
+			occupied[(br*bricks + bt)*bricks + bs] = found;
+		}
+	});
+
+	// 2. greedy merge : grow each box along s, then t, then r, as long as
+	// every brick it would swallow is occupied and not taken yet
+	auto free_brick = [&](int s, int t, int r){
+		return occupied[(r*bricks + t)*bricks + s] == 1;
+	};
+	for (int r = 0; r < bricks; r++)
+	for (int t = 0; t < bricks; t++)
+	for (int s = 0; s < bricks; s++){
+		if (!free_brick(s, t, r)) continue;
+
+		int s1 = s + 1;
+		while (s1 < bricks && free_brick(s1, t, r)) s1++;
+
+		int t1 = t + 1;
+		for (; t1 < bricks; t1++){
+			bool full = true;
+			for (int i = s; i < s1 && full; i++) full = free_brick(i, t1, r);
+			if (!full) break;
+		}
+
+		int r1 = r + 1;
+		for (; r1 < bricks; r1++){
+			bool full = true;
+			for (int j = t; j < t1 && full; j++)
+			for (int i = s; i < s1 && full; i++) full = free_brick(i, j, r1);
+			if (!full) break;
+		}
+
+		for (int k = r; k < r1; k++)
+		for (int j = t; j < t1; j++)
+		for (int i = s; i < s1; i++)
+			occupied[(k*bricks + j)*bricks + i] = 2;
+
+		ProxyBox box;
+		box.min = glm::vec3(s, t, r) * (float)brick / (float)n;
+		box.max = glm::min(glm::vec3(s1, t1, r1) * (float)brick / (float)n, glm::vec3(1.0f));
+		boxes.push_back(box);
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef OCCUPANCY_HPP
+#define OCCUPANCY_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// An axis aligned box, in texture coordinates ([0,1]^3)
+struct ProxyBox{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// Builds tight proxy geometry for an n*n*n 8 bit volume, stored with the
+// first texture coordinate varying fastest (as handed to glTexImage3D).
+// The volume is split into bricks of brick^3 voxels ; a brick is occupied
+// if any voxel within reach of linear filtering is non zero. Occupied
+// bricks are then merged greedily into as few boxes as possible.
+void buildProxyBoxes(const unsigned char * data, int n, int brick, std::vector<ProxyBox> & boxes);
+
+#endif
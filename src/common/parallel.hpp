@@ -0,0 +1,48 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <thread>
+#include <vector>
+
+// Number of worker threads the parallel helpers split their work into.
+inline int parallel_threads(){
+	int n = (int)std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+// Splits [begin,end) into one contiguous chunk per worker thread and calls
+// fn(chunk_begin, chunk_end, chunk) for each of them. The chunk index lets
+// callers keep per-thread partial results without any locking.
+// Returns after every chunk has been processed.
+template<typename F>
+void parallel_chunks(int begin, int end, int chunks, F fn){
+	int count = end - begin;
+	if (count <= 0) return;
+	if (chunks > count) chunks = count;
+	if (chunks <= 1){
+		fn(begin, end, 0);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	for (int c = 1; c < chunks; c++){
+		int b = begin + (int)((long long)count *  c    / chunks);
+		int e = begin + (int)((long long)count * (c+1) / chunks);
+		workers.push_back(std::thread(fn, b, e, c));
+	}
+	// the calling thread takes the first chunk itself
+	fn(begin, begin + (int)((long long)count / chunks), 0);
+
+	for (auto & worker : workers)
+		worker.join();
+}
+
+// Same as parallel_chunks, with one chunk per hardware thread.
+template<typename F>
+void parallel_for(int begin, int end, F fn){
+	parallel_chunks(begin, end, parallel_threads(), [&](int b, int e, int){
+		fn(b, e);
+	});
+}
+
+#endif
@@ -1,9 +1,10 @@
-/* Coherent noise function over 1, 2 or 3 dimensions */
+/* Coherent noise function over 1, 2, 3 or 4 dimensions */
 /* (copyright Ken Perlin) */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <mutex>
 #include "perlin.hpp"
 
 namespace noise{
@@ -11,7 +12,7 @@ namespace noise{
 	static double g3[B + B + 2][3];
 	static double g2[B + B + 2][2];
 	static double g1[B + B + 2];
-	static int start = 1;
+	static std::once_flag initialized;   /* the tables, filled on first use by any thread */
 
 
 	double noise1(double arg)
@@ -20,10 +21,7 @@ namespace noise{
 	   double rx0, rx1, sx, t, u, v, vec[1];
 
 	   vec[0] = arg;
-	   if (start) {
-		  start = 0;
-		  init();
-	   }
+	   std::call_once(initialized, init);
 
 	   setup(0,bx0,bx1,rx0,rx1);
 
@@ -40,10 +38,7 @@ namespace noise{
 	   double rx0, rx1, ry0, ry1, *q, sx, sy, a, b, t, u, v;
 	   int i, j;
 
-	   if (start) {
-		  start = 0;
-		  init();
-	   }
+	   std::call_once(initialized, init);
 
 	   setup(0, bx0,bx1, rx0,rx1);
 	   setup(1, by0,by1, ry0,ry1);
@@ -70,23 +65,23 @@ namespace noise{
 	   return lerp(sy, a, b);
 	}
 
-	double noise3(double vec[3])
+	/* noise3 on the lattice of time slice bw : the hash of every corner
+	   is offset by bw, so each slice is a different field ; slice 0 is
+	   noise3 itself */
+	static double noise3_layer(double vec[3], int bw)
 	{
 	   int bx0, bx1, by0, by1, bz0, bz1, b00, b10, b01, b11;
 	   double rx0, rx1, ry0, ry1, rz0, rz1, *q, sy, sz, a, b, c, d, t, u, v;
 	   int i, j;
 
-	   if (start) {
-		  start = 0;
-		  init();
-	   }
+	   std::call_once(initialized, init);
 
 	   setup(0, bx0,bx1, rx0,rx1);
 	   setup(1, by0,by1, ry0,ry1);
 	   setup(2, bz0,bz1, rz0,rz1);
 
-	   i = p[ bx0 ];
-	   j = p[ bx1 ];
+	   i = p[ bx0 + bw ];
+	   j = p[ bx1 + bw ];
 
 	   b00 = p[ i + by0 ];
 	   b10 = p[ j + by0 ];
@@ -120,6 +115,105 @@ namespace noise{
 	   return lerp(sz, c, d);
 	}
 
+	double noise3(double vec[3])
+	{
+	   return noise3_layer(vec, 0);
+	}
+
+	/* Same as noise3_layer, and also writes the analytic gradient of the
+	   noise to grad : each corner contributes its gradient vector weighted
+	   by the interpolation weights, plus its value weighted by their
+	   derivatives. */
+	static double noise3_layer_deriv(double vec[3], int bw, double grad[3])
+	{
+	   int bx[2], by[2], bz[2];
+	   double rx[2], ry[2], rz[2], *q, t, u;
+	   double wx[2], wy[2], wz[2], dwx[2], dwy[2], dwz[2];
+	   double value = 0;
+	   int i, j, k;
+
+	   std::call_once(initialized, init);
+
+	   setup(0, bx[0],bx[1], rx[0],rx[1]);
+	   setup(1, by[0],by[1], ry[0],ry[1]);
+	   setup(2, bz[0],bz[1], rz[0],rz[1]);
+
+	   t = s_curve(rx[0]); wx[0] = 1. - t; wx[1] = t;
+	   t = s_curve(ry[0]); wy[0] = 1. - t; wy[1] = t;
+	   t = s_curve(rz[0]); wz[0] = 1. - t; wz[1] = t;
+	   t = s_curve_deriv(rx[0]); dwx[0] = -t; dwx[1] = t;
+	   t = s_curve_deriv(ry[0]); dwy[0] = -t; dwy[1] = t;
+	   t = s_curve_deriv(rz[0]); dwz[0] = -t; dwz[1] = t;
+
+	   grad[0] = grad[1] = grad[2] = 0;
+	   for (i = 0; i < 2; i++)
+	   for (j = 0; j < 2; j++)
+	   for (k = 0; k < 2; k++) {
+		  q = g3[ p[ p[ bx[i] + bw ] + by[j] ] + bz[k] ];
+		  u = at3(rx[i],ry[j],rz[k]);
+		  value   += wx[i] * wy[j] * wz[k] * u;
+		  grad[0] += dwx[i] * wy[j] * wz[k] * u + wx[i] * wy[j] * wz[k] * q[0];
+		  grad[1] += wx[i] * dwy[j] * wz[k] * u + wx[i] * wy[j] * wz[k] * q[1];
+		  grad[2] += wx[i] * wy[j] * dwz[k] * u + wx[i] * wy[j] * wz[k] * q[2];
+	   }
+
+	   return value;
+	}
+
+	double noise3_deriv(double vec[3], double grad[3])
+	{
+	   return noise3_layer_deriv(vec, 0, grad);
+	}
+
+	/* the two time slices around w and the weight of the second one,
+	   as setup does for the space axes */
+	static double time_slices(double w, int & bw0, int & bw1)
+	{
+	   double t = w + N, r;
+	   bw0 = ((int)t) & BM;
+	   bw1 = (bw0+1) & BM;
+	   r = t - (int)t;
+	   return s_curve(r);
+	}
+
+	/* Noise over x, y, z and time w : the noise3 fields of the two time
+	   slices around w, blended with the same s-curve. At w = 0 it is
+	   noise3, and it never leaves the range noise3 covers. */
+	double noise4(double vec[4])
+	{
+	   int bw0, bw1;
+	   double sw;
+
+	   std::call_once(initialized, init);
+
+	   sw = time_slices(vec[3], bw0, bw1);
+	   /* on a slice, as all of a still volume is, the other one has no
+	      weight : one noise3 instead of two */
+	   if (sw == 0)
+		  return noise3_layer(vec, bw0);
+	   return lerp(sw, noise3_layer(vec, bw0), noise3_layer(vec, bw1));
+	}
+
+	/* Same as noise4, and also writes the gradient with respect to x, y
+	   and z to grad */
+	double noise4_deriv(double vec[4], double grad[3])
+	{
+	   int bw0, bw1;
+	   double sw, a, b, g0[3], g1[3];
+	   int k;
+
+	   std::call_once(initialized, init);
+
+	   sw = time_slices(vec[3], bw0, bw1);
+	   if (sw == 0)
+		  return noise3_layer_deriv(vec, bw0, grad);
+	   a = noise3_layer_deriv(vec, bw0, g0);
+	   b = noise3_layer_deriv(vec, bw1, g1);
+	   for (k = 0; k < 3; k++)
+		  grad[k] = lerp(sw, g0[k], g1[k]);
+	   return lerp(sw, a, b);
+	}
+
 	void normalize2(double v[2])
 	{
 	   double s;
@@ -233,5 +327,82 @@ namespace noise{
 	   }
 	   return(sum);
 	}
-}
 
+	double PerlinNoise4D(double x,double y,double z,double w,double alpha,double beta,int n)
+	{
+	   int i;
+	   double val,sum = 0;
+	   double p[4],scale = 1;
+
+	   p[0] = x;
+	   p[1] = y;
+	   p[2] = z;
+	   p[3] = w;
+	   for (i=0;i<n;i++) {
+		  val = noise4(p);
+		  sum += val / scale;
+		  scale *= alpha;
+		  p[0] *= beta;
+		  p[1] *= beta;
+		  p[2] *= beta;
+		  p[3] *= beta;
+	   }
+	   return(sum);
+	}
+
+	/* Same as PerlinNoise3D, and also writes the gradient of the sum with
+	   respect to x, y and z to grad. */
+	double PerlinNoise3D_deriv(double x,double y,double z,double alpha,double beta,int n,double grad[3])
+	{
+	   int i;
+	   double val,sum = 0;
+	   double p[3],g[3],scale = 1,freq = 1;
+
+	   p[0] = x;
+	   p[1] = y;
+	   p[2] = z;
+	   grad[0] = grad[1] = grad[2] = 0;
+	   for (i=0;i<n;i++) {
+		  val = noise3_deriv(p,g);
+		  sum += val / scale;
+		  grad[0] += g[0] * freq / scale;
+		  grad[1] += g[1] * freq / scale;
+		  grad[2] += g[2] * freq / scale;
+		  scale *= alpha;
+		  freq *= beta;
+		  p[0] *= beta;
+		  p[1] *= beta;
+		  p[2] *= beta;
+	   }
+	   return(sum);
+	}
+
+	/* Same as PerlinNoise4D, and also writes the gradient of the sum with
+	   respect to x, y and z to grad. */
+	double PerlinNoise4D_deriv(double x,double y,double z,double w,double alpha,double beta,int n,double grad[3])
+	{
+	   int i;
+	   double val,sum = 0;
+	   double p[4],g[3],scale = 1,freq = 1;
+
+	   p[0] = x;
+	   p[1] = y;
+	   p[2] = z;
+	   p[3] = w;
+	   grad[0] = grad[1] = grad[2] = 0;
+	   for (i=0;i<n;i++) {
+		  val = noise4_deriv(p,g);
+		  sum += val / scale;
+		  grad[0] += g[0] * freq / scale;
+		  grad[1] += g[1] * freq / scale;
+		  grad[2] += g[2] * freq / scale;
+		  scale *= alpha;
+		  freq *= beta;
+		  p[0] *= beta;
+		  p[1] *= beta;
+		  p[2] *= beta;
+		  p[3] *= beta;
+	   }
+	   return(sum);
+	}
+}
@@ -6,6 +6,7 @@ namespace noise{
 	#define NM 0xfff
 
 	#define s_curve(t) ( t * t * (3. - 2. * t) )
+	#define s_curve_deriv(t) ( 6. * t * (1. - t) )
 	#define lerp(t, a, b) ( a + t * (b - a) )
 	#define setup(i,b0,b1,r0,r1)\
 			t = vec[i] + N;\
@@ -20,11 +21,17 @@ namespace noise{
 	double noise1(double);
 	double noise2(double *);
 	double noise3(double *);
+	double noise3_deriv(double *, double *);
+	double noise4(double *);
+	double noise4_deriv(double *, double *);
 	void normalize3(double *);
 	void normalize2(double *);
 
 	double PerlinNoise1D(double,double,double,int);
 	double PerlinNoise2D(double,double,double,double,int);
 	double PerlinNoise3D(double,double,double,double,double,int);
+	double PerlinNoise3D_deriv(double,double,double,double,double,int,double *);
+	double PerlinNoise4D(double,double,double,double,double,double,int);
+	double PerlinNoise4D_deriv(double,double,double,double,double,double,int,double *);
 
 }
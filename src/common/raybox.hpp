@@ -0,0 +1,40 @@
+#ifndef RAYBOX_HPP
+#define RAYBOX_HPP
+
+#include <math.h>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+// Slab test of the ray origin + t * dir against the box [boxmin, boxmax].
+// On a hit, tnear and tfar receive the entry and exit distances along
+// the ray (tnear is negative when the origin is inside the box).
+// dir does not need to be normalized. Along an axis where dir is zero
+// the ray never crosses the slab planes : it is inside the slab for every
+// t or for none, tested on the origin (1/0 would give 0*inf = NaN when
+// the origin lies on a plane).
+inline bool intersectBox(const glm::vec3 & origin, const glm::vec3 & dir,
+                         const glm::vec3 & boxmin, const glm::vec3 & boxmax,
+                         float & tnear, float & tfar){
+	tnear = -INFINITY;
+	tfar  =  INFINITY;
+	for (int axis = 0; axis < 3; axis++){
+		if (dir[axis] == 0.0f){
+			if (origin[axis] < boxmin[axis] || origin[axis] > boxmax[axis])
+				return false;
+			continue;
+		}
+		float inv = 1.0f / dir[axis];
+		float t0 = (boxmin[axis] - origin[axis]) * inv;
+		float t1 = (boxmax[axis] - origin[axis]) * inv;
+		tnear = std::max(tnear, std::min(t0, t1));
+		tfar  = std::min(tfar,  std::max(t0, t1));
+	}
+	return tfar >= std::max(tnear, 0.0f);
+}
+
+// Same as above, against the unit cube the volume lives in
+inline bool intersectUnitCube(const glm::vec3 & origin, const glm::vec3 & dir, float & tnear, float & tfar){
+	return intersectBox(origin, dir, glm::vec3(0.0f), glm::vec3(1.0f), tnear, tfar);
+}
+
+#endif
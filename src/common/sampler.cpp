@@ -0,0 +1,186 @@
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "sampler.hpp"
+#include "parallel.hpp"
+
+// see sampler.hpp
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+void prepareSamplerVolume(const unsigned char * data, int n, SamplerVolume & volume){
+	int p = n + 3;
+	volume.n = n;
+	volume.layout = LinearLayout(p);
+	volume.voxels.assign(volume.layout.size() + 4, 0);
+	parallel_for(0, n, [&](int first, int last){
+		for (int r = first; r < last; r++)
+		for (int t = 0; t < n; t++)
+			memcpy(&volume.voxels[(((size_t)r+1)*p + t+1)*p + 1], data + ((size_t)r*n + t)*n, n);
+	});
+}
+
+bool samplerPathSupported(SamplerPath path){
+	switch (path){
+	case SAMPLER_AUTO:
+	case SAMPLER_SCALAR: return true;
+#ifdef SAMPLER_X86
+	case SAMPLER_SSE:    return __builtin_cpu_supports("sse4.1");
+	case SAMPLER_AVX2:   return __builtin_cpu_supports("avx2");
+	case SAMPLER_AVX512: return __builtin_cpu_supports("avx512f");
+#endif
+	default:             return false;
+	}
+}
+
+const char * samplerPathName(SamplerPath path){
+	switch (path){
+	case SAMPLER_SCALAR: return "scalar";
+	case SAMPLER_SSE:    return "sse";
+	case SAMPLER_AVX2:   return "avx2";
+	case SAMPLER_AVX512: return "avx512";
+	default:             return "auto";
+	}
+}
+
+float sampleReference(const unsigned char * data, int n, float s, float t, float r){
+	float x[3] = {s, t, r};
+	int i0[3];
+	float alpha[3];
+	for (int k = 0; k < 3; k++){
+		float u = std::min(std::max(x[k] * n - 0.5f, -1.0f), (float)n);
+		float f = floorf(u);
+		i0[k] = (int)f;
+		alpha[k] = u - f;
+	}
+	// texels outside the volume are the border color
+	float texel[2][2][2];
+	for (int dr = 0; dr < 2; dr++)
+	for (int dt = 0; dt < 2; dt++)
+	for (int ds = 0; ds < 2; ds++){
+		int i = i0[0] + ds, j = i0[1] + dt, k = i0[2] + dr;
+		bool inside = i >= 0 && i < n && j >= 0 && j < n && k >= 0 && k < n;
+		texel[dr][dt][ds] = inside ? data[((size_t)k*n + j)*n + i] : 0.0f;
+	}
+	float c[2][2];
+	for (int dr = 0; dr < 2; dr++)
+	for (int dt = 0; dt < 2; dt++)
+		c[dr][dt] = texel[dr][dt][0] + alpha[0] * (texel[dr][dt][1] - texel[dr][dt][0]);
+	float c0 = c[0][0] + alpha[1] * (c[0][1] - c[0][0]);
+	float c1 = c[1][0] + alpha[1] * (c[1][1] - c[1][0]);
+	return (c0 + alpha[2] * (c1 - c0)) * (1.0f / 255.0f);
+}
+
+#ifdef SAMPLER_X86
+
+__attribute__((target("sse4.1")))
+static size_t batchSSE(const SamplerVolume & volume, const float * s, const float * t, const float * r, float * out, size_t count){
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(out + i, sampleVolumeSSE(volume, _mm_loadu_ps(s + i), _mm_loadu_ps(t + i), _mm_loadu_ps(r + i)));
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t batchAVX2(const SamplerVolume & volume, const float * s, const float * t, const float * r, float * out, size_t count){
+	size_t i = 0;
+	__m256 all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(out + i, sampleVolumeAVX2(volume, _mm256_loadu_ps(s + i), _mm256_loadu_ps(t + i), _mm256_loadu_ps(r + i), all));
+	return i;
+}
+
+__attribute__((target("avx512f")))
+static size_t batchAVX512(const SamplerVolume & volume, const float * s, const float * t, const float * r, float * out, size_t count){
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+		_mm512_storeu_ps(out + i, sampleVolumeAVX512(volume, _mm512_loadu_ps(s + i), _mm512_loadu_ps(t + i), _mm512_loadu_ps(r + i), 0xFFFF));
+	return i;
+}
+
+#endif
+
+void sampleBatch(const SamplerVolume & volume, const float * s, const float * t, const float * r,
+                 float * out, size_t count, SamplerPath path){
+	if (path == SAMPLER_AUTO)
+		path = samplerPathSupported(SAMPLER_AVX512) ? SAMPLER_AVX512 :
+		       samplerPathSupported(SAMPLER_AVX2)   ? SAMPLER_AVX2   :
+		       samplerPathSupported(SAMPLER_SSE)    ? SAMPLER_SSE    : SAMPLER_SCALAR;
+	if (!samplerPathSupported(path))
+		path = SAMPLER_SCALAR;
+
+	size_t done = 0;
+	switch (path){
+#ifdef SAMPLER_X86
+	case SAMPLER_SSE:    done = batchSSE(volume, s, t, r, out, count); break;
+	case SAMPLER_AVX2:   done = batchAVX2(volume, s, t, r, out, count); break;
+	case SAMPLER_AVX512: done = batchAVX512(volume, s, t, r, out, count); break;
+#endif
+	default: break;
+	}
+	// what does not fill a whole vector
+	for (size_t i = done; i < count; i++)
+		out[i] = sampleVolume(volume, s[i], t[i], r[i]);
+}
+
+template<class Layout>
+void sampleBatch(const LayoutVolume<Layout> & volume, const float * s, const float * t, const float * r,
+                 float * out, size_t count){
+	for (size_t i = 0; i < count; i++)
+		out[i] = sampleVolume(volume, s[i], t[i], r[i]);
+}
+
+template void sampleBatch(const LayoutVolume<BrickedLayout<4> > &, const float *, const float *, const float *, float *, size_t);
+template void sampleBatch(const LayoutVolume<BrickedLayout<8> > &, const float *, const float *, const float *, float *, size_t);
+
+template<class Layout>
+static size_t compareLayout(const unsigned char * data, int n, const std::vector<float> & s, const std::vector<float> & t,
+                            const std::vector<float> & r, const std::vector<float> & expected){
+	LayoutVolume<Layout> volume;
+	prepareSamplerVolume(data, n, volume);
+	std::vector<float> got(expected.size());
+	sampleBatch(volume, &s[0], &t[0], &r[0], &got[0], got.size());
+	size_t mismatches = 0;
+	for (size_t i = 0; i < got.size(); i++)
+		mismatches += memcmp(&got[i], &expected[i], sizeof(float)) != 0;
+	return mismatches;
+}
+
+size_t validateSampler(const unsigned char * data, int n, size_t count){
+	SamplerVolume volume;
+	prepareSamplerVolume(data, n, volume);
+
+	// mostly inside the volume, some of the way out past the border, and
+	// the texel centers and edges where rounding matters most
+	std::vector<float> s(count), t(count), r(count), expected(count), got(count);
+	srand(1);
+	for (size_t i = 0; i < count; i++){
+		float * x[3] = {&s[i], &t[i], &r[i]};
+		for (int k = 0; k < 3; k++){
+			float random = (float)rand() / RAND_MAX;
+			switch (i % 4){
+			case 0:  *x[k] = random; break;
+			case 1:  *x[k] = random * 1.2f - 0.1f; break;
+			case 2:  *x[k] = (rand() % (n+2) - 0.5f) / n; break;
+			default: *x[k] = (float)(rand() % (n+1)) / n; break;
+			}
+		}
+		expected[i] = sampleReference(data, n, s[i], t[i], r[i]);
+	}
+
+	size_t mismatches = 0;
+	SamplerPath paths[] = {SAMPLER_SCALAR, SAMPLER_SSE, SAMPLER_AVX2, SAMPLER_AVX512};
+	for (SamplerPath path : paths){
+		if (!samplerPathSupported(path)) continue;
+		sampleBatch(volume, &s[0], &t[0], &r[0], &got[0], count, path);
+		for (size_t i = 0; i < count; i++)
+			mismatches += memcmp(&got[i], &expected[i], sizeof(float)) != 0;
+	}
+	mismatches += compareLayout<BrickedLayout<4> >(data, n, s, t, r, expected);
+	mismatches += compareLayout<BrickedLayout<8> >(data, n, s, t, r, expected);
+	return mismatches;
+}
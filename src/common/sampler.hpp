@@ -0,0 +1,249 @@
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include <math.h>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+#include "volumelayout.hpp"
+#include "numa.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAMPLER_X86
+#include <immintrin.h>
+#endif
+
+// An 8 bit luminance volume sampled the way tex3D samples volume_texture :
+// GL_LINEAR filtering, GL_CLAMP_TO_BORDER wrapping with a black border,
+// and the luminance expanded to [0,1]. Samples are the luminance ; the
+// RGBA tex3D returns is (L,L,L,1).
+// The voxels are stored with a border of zeros, one voxel thick below and
+// two above, so every lookup of a clamped coordinate is in bounds and no
+// sample needs a branch. A few bytes of padding at the end let the vector
+// paths gather two neighbours with one 32 bit load.
+// The bordered volume is stored in any of the layouts of volumelayout.hpp ;
+// the vector paths need the linear one.
+template<class Layout>
+struct LayoutVolume{
+	int n;
+	Layout layout;      // of the bordered volume, n+3 a side
+	NumaBytes voxels;   // interleaved over the NUMA nodes, unless a replica
+};
+
+typedef LayoutVolume<LinearLayout> SamplerVolume;
+
+// Copies an n*n*n volume, first texture coordinate fastest
+void prepareSamplerVolume(const unsigned char * data, int n, SamplerVolume & volume);
+
+template<class Layout>
+void prepareSamplerVolume(const unsigned char * data, int n, LayoutVolume<Layout> & volume){
+	volume.n = n;
+	volume.layout = Layout(n + 3);
+	volume.voxels.assign(volume.layout.size() + 4, 0);
+	parallel_for(0, n, [&](int first, int last){
+		for (int r = first; r < last; r++)
+		for (int t = 0; t < n; t++)
+		for (int s = 0; s < n; s++)
+			volume.voxels[volume.layout.index(s+1, t+1, r+1)] = data[((size_t)r*n + t)*n + s];
+	});
+}
+
+// One copy of volume in the memory of each NUMA node, replicas[node],
+// for renderers reading it from every socket
+template<class Layout>
+void replicateVolume(const LayoutVolume<Layout> & volume, std::vector<LayoutVolume<Layout> > & replicas){
+	int nodes = numaNodes();
+	replicas.resize(nodes);
+	for (int node = 0; node < nodes; node++){
+		LayoutVolume<Layout> & replica = replicas[node];
+		replica.n = volume.n;
+		replica.layout = volume.layout;
+		NumaBytes voxels(volume.voxels.begin(), volume.voxels.end(), NumaAllocator<unsigned char>(node));
+		replica.voxels.swap(voxels);
+	}
+}
+
+enum SamplerPath{
+	SAMPLER_AUTO,     // the widest path the processor supports
+	SAMPLER_SCALAR,
+	SAMPLER_SSE,      // SSE 4.1, 4 samples at a time, fetched one by one
+	SAMPLER_AVX2,     // 8 samples at a time, gathered
+	SAMPLER_AVX512    // 16 samples at a time, gathered
+};
+
+bool samplerPathSupported(SamplerPath path);
+const char * samplerPathName(SamplerPath path);
+
+// The definition every path reproduces bit for bit : the OpenGL formula
+// on the unbordered volume, texels outside of it reading as the border.
+// Coordinates are clamped to [-1/2n, 1+1/2n] as GL_CLAMP_TO_BORDER does,
+// interpolation goes along s, then t, then r, and floating point
+// contraction must stay off, which this header and sampler.cpp see to.
+float sampleReference(const unsigned char * data, int n, float s, float t, float r);
+
+// Samples count positions (s[i], t[i], r[i]) into out
+void sampleBatch(const SamplerVolume & volume, const float * s, const float * t, const float * r,
+                 float * out, size_t count, SamplerPath path = SAMPLER_AUTO);
+
+// The scalar path, for volumes in the other layouts
+template<class Layout>
+void sampleBatch(const LayoutVolume<Layout> & volume, const float * s, const float * t, const float * r,
+                 float * out, size_t count);
+
+// Compares every supported path, and the scalar one on the bricked
+// layouts, with sampleReference on count random positions, in and around
+// the unit cube. Returns the number of samples that differ in any bit.
+size_t validateSampler(const unsigned char * data, int n, size_t count);
+
+// rounding is part of the definition : no fused multiply-adds from here
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+// texel space of the bordered volume : the texel index and weight of the
+// lower of the two texels a coordinate falls between
+inline void samplerTexel(float x, int n, int & index, float & weight){
+	float u = std::min(std::max(x * n - 0.5f, -1.0f), (float)n);
+	float f = floorf(u);
+	weight = u - f;
+	index = (int)f + 1;
+}
+
+template<class Layout>
+inline float sampleVolume(const LayoutVolume<Layout> & volume, float s, float t, float r){
+	int n = volume.n;
+	int i, j, k;
+	float a, b, c;
+	samplerTexel(s, n, i, a);
+	samplerTexel(t, n, j, b);
+	samplerTexel(r, n, k, c);
+	const Layout & layout = volume.layout;
+	const unsigned char * v = &volume.voxels[0];
+	float v000 = v[layout.index(i, j,   k  )], v001 = v[layout.index(i+1, j,   k  )];
+	float v010 = v[layout.index(i, j+1, k  )], v011 = v[layout.index(i+1, j+1, k  )];
+	float v100 = v[layout.index(i, j,   k+1)], v101 = v[layout.index(i+1, j,   k+1)];
+	float v110 = v[layout.index(i, j+1, k+1)], v111 = v[layout.index(i+1, j+1, k+1)];
+	float c00 = v000 + a * (v001 - v000);
+	float c01 = v010 + a * (v011 - v010);
+	float c10 = v100 + a * (v101 - v100);
+	float c11 = v110 + a * (v111 - v110);
+	float c0 = c00 + b * (c01 - c00);
+	float c1 = c10 + b * (c11 - c10);
+	return (c0 + c * (c1 - c0)) * (1.0f / 255.0f);
+}
+
+#ifdef SAMPLER_X86
+
+// Vector versions of sampleVolume. The AVX2 and AVX-512 ones skip the
+// lanes outside active, which then read as 0.
+
+__attribute__((target("sse4.1")))
+inline __m128 sampleVolumeSSE(const SamplerVolume & volume, __m128 s, __m128 t, __m128 r){
+	int n = volume.n, p = n + 3;
+	__m128 size = _mm_set1_ps((float)n), half = _mm_set1_ps(0.5f);
+	__m128 low = _mm_set1_ps(-1.0f);
+	__m128 u = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(s, size), half), low), size);
+	__m128 v = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(t, size), half), low), size);
+	__m128 w = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(r, size), half), low), size);
+	__m128 fu = _mm_floor_ps(u), fv = _mm_floor_ps(v), fw = _mm_floor_ps(w);
+	u = _mm_sub_ps(u, fu); v = _mm_sub_ps(v, fv); w = _mm_sub_ps(w, fw);
+
+	__m128i one = _mm_set1_epi32(1);
+	__m128i index = _mm_add_epi32(_mm_add_epi32(_mm_cvttps_epi32(fu), one),
+	                _mm_add_epi32(_mm_mullo_epi32(_mm_add_epi32(_mm_cvttps_epi32(fv), one), _mm_set1_epi32(p)),
+	                              _mm_mullo_epi32(_mm_add_epi32(_mm_cvttps_epi32(fw), one), _mm_set1_epi32(p*p))));
+	int lanes[4];
+	_mm_storeu_si128((__m128i *)lanes, index);
+
+	// no gathers : the 8 texels of each lane are fetched one by one
+	size_t row = p, slab = (size_t)p*p;
+	float texels[8][4];
+	for (int l = 0; l < 4; l++){
+		const unsigned char * x = &volume.voxels[lanes[l]];
+		texels[0][l] = x[0];        texels[1][l] = x[1];
+		texels[2][l] = x[row];      texels[3][l] = x[row+1];
+		texels[4][l] = x[slab];     texels[5][l] = x[slab+1];
+		texels[6][l] = x[slab+row]; texels[7][l] = x[slab+row+1];
+	}
+	__m128 c[4];
+	for (int k = 0; k < 4; k++){
+		__m128 c0 = _mm_loadu_ps(texels[2*k]), c1 = _mm_loadu_ps(texels[2*k+1]);
+		c[k] = _mm_add_ps(c0, _mm_mul_ps(u, _mm_sub_ps(c1, c0)));
+	}
+	__m128 c0 = _mm_add_ps(c[0], _mm_mul_ps(v, _mm_sub_ps(c[1], c[0])));
+	__m128 c1 = _mm_add_ps(c[2], _mm_mul_ps(v, _mm_sub_ps(c[3], c[2])));
+	return _mm_mul_ps(_mm_add_ps(c0, _mm_mul_ps(w, _mm_sub_ps(c1, c0))), _mm_set1_ps(1.0f / 255.0f));
+}
+
+__attribute__((target("avx2")))
+inline __m256 sampleVolumeAVX2(const SamplerVolume & volume, __m256 s, __m256 t, __m256 r, __m256 active){
+	int n = volume.n, p = n + 3;
+	__m256 size = _mm256_set1_ps((float)n), half = _mm256_set1_ps(0.5f);
+	__m256 low = _mm256_set1_ps(-1.0f);
+	__m256 u = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(s, size), half), low), size);
+	__m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(t, size), half), low), size);
+	__m256 w = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(r, size), half), low), size);
+	__m256 fu = _mm256_floor_ps(u), fv = _mm256_floor_ps(v), fw = _mm256_floor_ps(w);
+	u = _mm256_sub_ps(u, fu); v = _mm256_sub_ps(v, fv); w = _mm256_sub_ps(w, fw);
+
+	__m256i one = _mm256_set1_epi32(1), row = _mm256_set1_epi32(p), slab = _mm256_set1_epi32(p*p);
+	__m256i index = _mm256_add_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fu), one),
+	                _mm256_add_epi32(_mm256_mullo_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fv), one), row),
+	                                 _mm256_mullo_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fw), one), slab)));
+
+	// two neighbours along s per 32 bit gather : 4 gathers for 8 texels
+	const int * base = (const int *)&volume.voxels[0];
+	__m256i mask = _mm256_castps_si256(active), bytes = _mm256_set1_epi32(0xFF);
+	__m256 c[4];
+	for (int k = 0; k < 4; k++){
+		__m256i offset = _mm256_add_epi32(index, _mm256_add_epi32((k & 1) ? row : _mm256_setzero_si256(), (k & 2) ? slab : _mm256_setzero_si256()));
+		__m256i pair = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), base, offset, mask, 1);
+		__m256 c0 = _mm256_cvtepi32_ps(_mm256_and_si256(pair, bytes));
+		__m256 c1 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pair, 8), bytes));
+		c[k] = _mm256_add_ps(c0, _mm256_mul_ps(u, _mm256_sub_ps(c1, c0)));
+	}
+	__m256 c0 = _mm256_add_ps(c[0], _mm256_mul_ps(v, _mm256_sub_ps(c[1], c[0])));
+	__m256 c1 = _mm256_add_ps(c[2], _mm256_mul_ps(v, _mm256_sub_ps(c[3], c[2])));
+	return _mm256_mul_ps(_mm256_add_ps(c0, _mm256_mul_ps(w, _mm256_sub_ps(c1, c0))), _mm256_set1_ps(1.0f / 255.0f));
+}
+
+__attribute__((target("avx512f")))
+inline __m512 sampleVolumeAVX512(const SamplerVolume & volume, __m512 s, __m512 t, __m512 r, __mmask16 active){
+	int n = volume.n, p = n + 3;
+	__m512 size = _mm512_set1_ps((float)n), half = _mm512_set1_ps(0.5f);
+	__m512 low = _mm512_set1_ps(-1.0f);
+	__m512 u = _mm512_min_ps(_mm512_max_ps(_mm512_sub_ps(_mm512_mul_ps(s, size), half), low), size);
+	__m512 v = _mm512_min_ps(_mm512_max_ps(_mm512_sub_ps(_mm512_mul_ps(t, size), half), low), size);
+	__m512 w = _mm512_min_ps(_mm512_max_ps(_mm512_sub_ps(_mm512_mul_ps(r, size), half), low), size);
+	__m512 fu = _mm512_floor_ps(u), fv = _mm512_floor_ps(v), fw = _mm512_floor_ps(w);
+	u = _mm512_sub_ps(u, fu); v = _mm512_sub_ps(v, fv); w = _mm512_sub_ps(w, fw);
+
+	__m512i one = _mm512_set1_epi32(1), row = _mm512_set1_epi32(p), slab = _mm512_set1_epi32(p*p);
+	__m512i index = _mm512_add_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fu), one),
+	                _mm512_add_epi32(_mm512_mullo_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fv), one), row),
+	                                 _mm512_mullo_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fw), one), slab)));
+
+	const int * base = (const int *)&volume.voxels[0];
+	__m512i bytes = _mm512_set1_epi32(0xFF);
+	__m512 c[4];
+	for (int k = 0; k < 4; k++){
+		__m512i offset = _mm512_add_epi32(index, _mm512_add_epi32((k & 1) ? row : _mm512_setzero_si512(), (k & 2) ? slab : _mm512_setzero_si512()));
+		__m512i pair = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), active, offset, base, 1);
+		__m512 c0 = _mm512_cvtepi32_ps(_mm512_and_si512(pair, bytes));
+		__m512 c1 = _mm512_cvtepi32_ps(_mm512_and_si512(_mm512_srli_epi32(pair, 8), bytes));
+		c[k] = _mm512_add_ps(c0, _mm512_mul_ps(u, _mm512_sub_ps(c1, c0)));
+	}
+	__m512 c0 = _mm512_add_ps(c[0], _mm512_mul_ps(v, _mm512_sub_ps(c[1], c[0])));
+	__m512 c1 = _mm512_add_ps(c[2], _mm512_mul_ps(v, _mm512_sub_ps(c[3], c[2])));
+	return _mm512_mul_ps(_mm512_add_ps(c0, _mm512_mul_ps(w, _mm512_sub_ps(c1, c0))), _mm512_set1_ps(1.0f / 255.0f));
+}
+
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+#endif
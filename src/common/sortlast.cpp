@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <glm/glm.hpp>
+
+#include "sortlast.hpp"
+
+namespace sortlast{
+
+	typedef std::chrono::steady_clock Clock;
+
+	// what every rank tells rank 0 along with its part of the image
+	struct Report{
+		double renderSeconds;
+		double compositeSeconds;
+		size_t bytesSent;
+		size_t first, last;
+	};
+
+	static double seconds(Clock::time_point from){
+		return std::chrono::duration<double>(Clock::now() - from).count();
+	}
+
+	static bool sendAll(int socket, const void * data, size_t size){
+		const char * bytes = (const char *)data;
+		while (size > 0){
+			ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+			if (sent <= 0) return false;
+			bytes += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+	static bool receiveAll(int socket, void * data, size_t size){
+		char * bytes = (char *)data;
+		while (size > 0){
+			ssize_t received = recv(socket, bytes, size, 0);
+			if (received <= 0) return false;
+			bytes += received;
+			size -= received;
+		}
+		return true;
+	}
+
+	void brickBounds(int rank, int ranks, glm::vec3 & boxmin, glm::vec3 & boxmax){
+		boxmin = glm::vec3(0.0f);
+		boxmax = glm::vec3(1.0f);
+		int levels = 0;
+		while ((1 << levels) < ranks) levels++;
+		for (int level = 0; level < levels; level++){
+			int axis = level % 3;
+			float middle = (boxmin[axis] + boxmax[axis]) * 0.5f;
+			if (rank >> (levels - 1 - level) & 1)
+				boxmin[axis] = middle;
+			else
+				boxmax[axis] = middle;
+		}
+	}
+
+	void composite(CpuRayFragment * own, const CpuRayFragment * other, size_t count){
+		for (size_t i = 0; i < count; i++){
+			bool behind = other[i].depth < own[i].depth;
+			const CpuRayFragment & front = behind ? other[i] : own[i];
+			const CpuRayFragment & back  = behind ? own[i] : other[i];
+			// the back samples come after front.opacity more alpha_acc
+			CpuRayFragment result;
+			result.r = front.r + back.r - front.opacity * back.sr;
+			result.g = front.g + back.g - front.opacity * back.sg;
+			result.b = front.b + back.b - front.opacity * back.sb;
+			result.a = front.a + back.a - front.opacity * back.sa;
+			result.opacity = front.opacity + back.opacity;
+			result.sr = front.sr + back.sr;
+			result.sg = front.sg + back.sg;
+			result.sb = front.sb + back.sb;
+			result.sa = front.sa + back.sa;
+			result.depth = front.depth;
+			own[i] = result;
+		}
+	}
+
+	bool binarySwap(int rank, int ranks, const std::vector<int> & peers, std::vector<CpuRayFragment> & image,
+	                size_t & first, size_t & last, size_t & bytesSent){
+		first = 0;
+		last = image.size();
+		std::vector<CpuRayFragment> incoming;
+		for (int bit = 1; bit < ranks; bit <<= 1){
+			int partner = peers[rank ^ bit];
+			// the lower rank keeps the first half
+			size_t middle = first + (last - first) / 2;
+			bool lower = (rank & bit) == 0;
+			size_t keepFirst = lower ? first : middle, keepLast = lower ? middle : last;
+			size_t sendFirst = lower ? middle : first, sendLast = lower ? last : middle;
+
+			// both partners send at once : one of them must not wait for
+			// the other to read
+			size_t sendBytes = (sendLast - sendFirst) * sizeof(CpuRayFragment);
+			bool sent = true;
+			std::thread sender([&](){
+				sent = sendAll(partner, image.data() + sendFirst, sendBytes);
+			});
+			incoming.resize(keepLast - keepFirst);
+			bool received = receiveAll(partner, incoming.data(), incoming.size() * sizeof(CpuRayFragment));
+			sender.join();
+			if (!sent || !received) return false;
+			bytesSent += sendBytes;
+
+			composite(image.data() + keepFirst, incoming.data(), incoming.size());
+			first = keepFirst;
+			last = keepLast;
+		}
+		return true;
+	}
+
+	// renders the brick of rank, composites, and gathers the result on
+	// rank 0, which converts it into rgba and stats
+	static bool renderRank(int rank, int ranks, const std::vector<int> & peers,
+	                       const SamplerVolume & volume, const glm::mat4 & mvp, const CpuRayOptions & options,
+	                       int width, int height, unsigned char * rgba, Stats * stats){
+		Report report = Report();
+		std::vector<CpuRayFragment> image((size_t)width * height);
+
+		Clock::time_point start = Clock::now();
+		glm::vec3 boxmin, boxmax;
+		brickBounds(rank, ranks, boxmin, boxmax);
+		renderVolumeBoxCPU(volume, boxmin, boxmax, mvp, options, width, height, image.data(), CPU_RAY_AUTO, rank, ranks);
+		report.renderSeconds = seconds(start);
+
+		start = Clock::now();
+		if (!binarySwap(rank, ranks, peers, image, report.first, report.last, report.bytesSent))
+			return false;
+
+		if (rank != 0){
+			report.compositeSeconds = seconds(start);
+			size_t bytes = (report.last - report.first) * sizeof(CpuRayFragment);
+			report.bytesSent += bytes;
+			return sendAll(peers[0], &report, sizeof(report))
+			    && sendAll(peers[0], image.data() + report.first, bytes);
+		}
+
+		Stats total = Stats();
+		total.ranks = ranks;
+		total.renderSeconds = report.renderSeconds;
+		total.bytesSent = report.bytesSent;
+		double slowestSwap = 0;
+		for (int r = 1; r < ranks; r++){
+			Report piece;
+			if (!receiveAll(peers[r], &piece, sizeof(piece)) || piece.last > image.size() || piece.first > piece.last)
+				return false;
+			if (!receiveAll(peers[r], image.data() + piece.first, (piece.last - piece.first) * sizeof(CpuRayFragment)))
+				return false;
+			total.renderSeconds = std::max(total.renderSeconds, piece.renderSeconds);
+			slowestSwap = std::max(slowestSwap, piece.compositeSeconds);
+			total.bytesSent += piece.bytesSent;
+		}
+		total.compositeSeconds = std::max(slowestSwap, seconds(start));
+
+		for (size_t i = 0; i < image.size(); i++){
+			float channels[4] = {image[i].r, image[i].g, image[i].b, image[i].a};
+			for (int c = 0; c < 4; c++)
+				rgba[i*4 + c] = (unsigned char)(std::min(std::max(channels[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+		}
+		if (stats) *stats = total;
+		return true;
+	}
+
+	// closes the sockets that are not rank's own
+	static void keepSockets(std::vector<std::vector<int> > & sockets, int rank){
+		for (size_t i = 0; i < sockets.size(); i++)
+		for (size_t j = 0; j < sockets.size(); j++)
+			if ((int)i != rank && sockets[i][j] >= 0){
+				close(sockets[i][j]);
+				sockets[i][j] = -1;
+			}
+	}
+
+	bool renderVolumeSortLast(const SamplerVolume & volume, const glm::mat4 & mvp, const CpuRayOptions & options,
+	                          int width, int height, unsigned char * rgba, int processes, Stats * stats){
+		int ranks = 1;
+		while (ranks * 2 <= processes) ranks *= 2;
+
+		// sockets[i][j] : the end rank i talks to rank j through
+		std::vector<std::vector<int> > sockets(ranks, std::vector<int>(ranks, -1));
+		bool ok = true;
+		for (int i = 0; i < ranks; i++)
+		for (int j = i + 1; j < ranks && ok; j++){
+			int pair[2];
+			ok = socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0;
+			if (ok){
+				sockets[i][j] = pair[0];
+				sockets[j][i] = pair[1];
+			}
+		}
+
+		// the workers share the volume with rank 0, copy on write
+		std::vector<pid_t> workers;
+		for (int rank = 1; rank < ranks && ok; rank++){
+			pid_t pid = fork();
+			if (pid == 0){
+				keepSockets(sockets, rank);
+				bool done = renderRank(rank, ranks, sockets[rank], volume, mvp, options, width, height, NULL, NULL);
+				_exit(done ? 0 : 1);
+			}
+			if (pid < 0)
+				ok = false;
+			else
+				workers.push_back(pid);
+		}
+
+		keepSockets(sockets, 0);
+		// without every worker the others would wait forever : closing
+		// rank 0's sockets makes them fail instead
+		if (ok)
+			ok = renderRank(0, ranks, sockets[0], volume, mvp, options, width, height, rgba, stats);
+		for (int socket : sockets[0])
+			if (socket >= 0) close(socket);
+
+		for (pid_t pid : workers){
+			int status = 0;
+			if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				ok = false;
+		}
+		return ok;
+	}
+}
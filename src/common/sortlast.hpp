@@ -0,0 +1,65 @@
+#ifndef SORTLAST_HPP
+#define SORTLAST_HPP
+
+#include <vector>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+#include "cpuraycast.hpp"
+
+// Sort-last parallel rendering : each of a power of two ranks marches the
+// rays through its own brick of the volume into a partial image of
+// fragments, then the images are composited by binary swap. At every
+// stage, partners exchange half of the part of the image they hold and
+// composite the half they keep, nearer fragment in front.
+// After log2(ranks) stages each rank holds 1/ranks of the final image.
+// Ranks talk over connected stream sockets, Unix or TCP alike.
+//
+// The composite is not "over" : along a ray, the fragment program
+// weights each sample by 1 - alpha_acc, alpha_acc being the plain sum of
+// the opacities before it. Behind a front fragment of opacity Af, each
+// sample of a back fragment weighs Af * 3 * opacity * delta less than in
+// the back fragment alone, so fragments also keep S, their color summed
+// without the weights :
+//   C = Cf + Cb - Af * Sb,   A = Af + Ab,   S = Sf + Sb
+// per channel, C the color and A the opacity. That is the whole ray
+// again, and associative, so the order of the stages does not matter.
+// What stays apart from the whole ray : rays that reach alpha_acc 1, or
+// MAX_STEPS, stop within a brick rather than within the whole ray, each
+// brick starts its steps where the ray enters it, and color_mode's hue
+// starts afresh in each brick. --cpu-bench measures the difference on a
+// view turned off the axes.
+namespace sortlast{
+
+	struct Stats{
+		int    ranks;
+		double renderSeconds;      // slowest rank
+		double compositeSeconds;   // slowest rank, binary swap and gather
+		size_t bytesSent;          // by all ranks
+	};
+
+	// The brick of the unit cube rank renders : the cube is halved along
+	// x, y, z, x... once per bit of rank, highest bit first, so the ranks
+	// that differ only in their low bits make up one box, which binary
+	// swap composites first.
+	void brickBounds(int rank, int ranks, glm::vec3 & boxmin, glm::vec3 & boxmax);
+
+	// Composites other into own, pixel by pixel, the nearer one in front
+	void composite(CpuRayFragment * own, const CpuRayFragment * other, size_t count);
+
+	// Binary swap of image among ranks ; peers[r] is the socket to rank r.
+	// On return, image[first, last) holds the final composite of that
+	// part. Returns false if a peer went away.
+	bool binarySwap(int rank, int ranks, const std::vector<int> & peers, std::vector<CpuRayFragment> & image,
+	                size_t & first, size_t & last, size_t & bytesSent);
+
+	// Renders the volume as renderVolumeCPU does, on processes local
+	// processes (rounded down to a power of two) forked for the frame :
+	// each renders its brick on its share of the cores, they composite
+	// over Unix socket pairs, and the calling process, rank 0, gathers
+	// the final image into rgba. Returns false if a worker failed.
+	bool renderVolumeSortLast(const SamplerVolume & volume, const glm::mat4 & mvp, const CpuRayOptions & options,
+	                          int width, int height, unsigned char * rgba, int processes, Stats * stats = NULL);
+}
+
+#endif
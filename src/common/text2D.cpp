@@ -9,9 +9,11 @@ using namespace glm;
 
 #include "shader.hpp"
 #include "texture.hpp"
+#include "texturecache.hpp"
 
 #include "text2D.hpp"
 
+TextureHandle Text2DTexture;
 unsigned int Text2DTextureID;
 unsigned int Text2DVertexBufferID;
 unsigned int Text2DUVBufferID;
@@ -20,8 +22,9 @@ unsigned int Text2DUniformID;
 
 void initText2D(const char * texturePath){
 
-	// Initialize texture
-	Text2DTextureID = loadTGA_glfw(texturePath);
+	// Initialize texture ; the cache makes repeated inits share the font
+	Text2DTexture = texturecache::loadNow(texturePath);
+	Text2DTextureID = Text2DTexture->id();
 
 	// Initialize VBO
 	glGenBuffers(1, &Text2DVertexBufferID);
@@ -116,8 +119,9 @@ void cleanupText2D(){
 	glDeleteBuffers(1, &Text2DVertexBufferID);
 	glDeleteBuffers(1, &Text2DUVBufferID);
 
-	// Delete texture
-	glDeleteTextures(1, &Text2DTextureID);
+	// Release texture ; the cache deletes it with its last handle
+	Text2DTexture.reset();
+	Text2DTextureID = 0;
 
 	// Delete shader
 	glDeleteProgram(Text2DShaderID);
@@ -1,202 +1,444 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include <GL/glew.h>
 
 #include <GL/glfw.h>
 
+#include "texture.hpp"
+#include "mipmap.hpp"
 
-GLuint loadBMP_custom(const char * imagepath){
+
+// Start of the pixel data of a decoded image ; the mip levels point into
+// either the mapped file or the owned storage.
+static const unsigned char * textureBytes(const TextureData & texture){
+	return texture.mapping ? texture.mapping : &texture.storage[0];
+}
+
+bool decodeBMP(const char * imagepath, TextureData & texture){
 
 	printf("Reading image %s\n", imagepath);
 
 	// Data read from the header of the BMP file
 	unsigned char header[54];
 	unsigned int dataPos;
-	unsigned int imageSize;
 	unsigned int width, height;
-	// Actual RGB data
-	unsigned char * data;
 
 	// Open the file
 	FILE * file = fopen(imagepath,"rb");
-	if (!file)							    {printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); return 0;}
+	if (!file)							    {printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); return false;}
 
 	// Read the header, i.e. the 54 first bytes
 
 	// If less than 54 byes are read, problem
 	if ( fread(header, 1, 54, file)!=54 ){ 
 		printf("Not a correct BMP file\n");
-		return 0;
+		fclose(file);
+		return false;
 	}
 	// A BMP files always begins with "BM"
 	if ( header[0]!='B' || header[1]!='M' ){
 		printf("Not a correct BMP file\n");
-		return 0;
+		fclose(file);
+		return false;
 	}
 	// Make sure this is a 24bpp file
-	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    return 0;}
-	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    return 0;}
+	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
+	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
 
 	// Read the information about the image
 	dataPos    = *(int*)&(header[0x0A]);
-	imageSize  = *(int*)&(header[0x22]);
 	width      = *(int*)&(header[0x12]);
 	height     = *(int*)&(header[0x16]);
 
 	// Some BMP files are misformatted, guess missing information
-	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
 	if (dataPos==0)      dataPos=54; // The BMP header is done that way
 
-	// Create a buffer
-	data = new unsigned char [imageSize];
-
-	// Read the actual data from the file into the buffer
-	fread(data,1,imageSize,file);
+	// Read the actual data from the file into the buffer, dropping the
+	// padding at the end of each row (rows are 4 byte aligned in BMPs)
+	unsigned int rowSize = width*3;
+	unsigned int paddedRowSize = (rowSize + 3) & ~3u;
+	std::vector<unsigned char> row(paddedRowSize);
+	texture.storage.resize(rowSize*height);
+	fseek(file, dataPos, SEEK_SET);
+	for (unsigned int y = 0; y < height; y++){
+		fread(&row[0],1,paddedRowSize,file);
+		memcpy(&texture.storage[y*rowSize], &row[0], rowSize);
+	}
 
 	// Everything is in memory now, the file wan be closed
 	fclose (file);
 
-	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-
-	// Give the image to OpenGL
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
+	texture.target         = GL_TEXTURE_2D;
+	texture.internalFormat = GL_RGB;
+	texture.format         = GL_BGR;
+	TextureLevel level = {width, height, 1, 0, rowSize*height};
+	texture.levels.push_back(level);
 
-	// OpenGL has now copied the data. Free our own version
-	delete [] data;
+	// ... and the mip chain, for nice trilinear filtering
+	buildMipmaps(texture);
+	return true;
+}
 
-	// Poor filtering, or ...
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
+bool decodeTGA(const char * imagepath, TextureData & texture){
 
-	// ... nice trilinear filtering.
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
-	glGenerateMipmap(GL_TEXTURE_2D);
+	// Read the file with GLFW's own loader, without touching OpenGL
+	GLFWimage image;
+	if (!glfwReadImage(imagepath, &image, 0)){
+		printf("%s could not be read\n", imagepath);
+		return false;
+	}
 
-	// Return the ID of the texture we just created
-	return textureID;
+	size_t size = (size_t)image.Width * image.Height * image.BytesPerPixel;
+	texture.storage.assign(image.Data, image.Data + size);
+	texture.target         = GL_TEXTURE_2D;
+	texture.internalFormat = image.Format;
+	texture.format         = image.Format;
+	TextureLevel level = {(unsigned int)image.Width, (unsigned int)image.Height, 1, 0, size};
+	texture.levels.push_back(level);
+	// clears every field of image, not only the pixels
+	glfwFreeImage(&image);
+
+	// Nice trilinear filtering needs the mip chain
+	buildMipmaps(texture);
+	return true;
 }
 
-GLuint loadTGA_glfw(const char * imagepath){
+GLuint uploadTexture(const TextureData & texture){
 
 	// Create one OpenGL texture
 	GLuint textureID;
 	glGenTextures(1, &textureID);
 
 	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
+	GLenum target = texture.target;
+	glBindTexture(target, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
 
-	// Read the file, call glTexImage2D with the right parameters
-	glfwLoadTexture2D(imagepath, 0);
+	// Give the image to OpenGL, one mip level at a time
+	const unsigned char * bytes = textureBytes(texture);
+	for (unsigned int i = 0; i < texture.levels.size(); i++){
+		const TextureLevel & l = texture.levels[i];
+		const unsigned char * data = bytes + l.offset;
+		if (texture.format == 0 && target == GL_TEXTURE_3D)
+			glCompressedTexImage3D(target, i, texture.internalFormat, l.width, l.height, l.depth, 0, l.size, data);
+		else if (texture.format == 0)
+			glCompressedTexImage2D(target, i, texture.internalFormat, l.width, l.height, 0, l.size, data);
+		else if (target == GL_TEXTURE_3D)
+			glTexImage3D(target, i, texture.internalFormat, l.width, l.height, l.depth, 0, texture.format, GL_UNSIGNED_BYTE, data);
+		else
+			glTexImage2D(target, i, texture.internalFormat, l.width, l.height, 0, texture.format, GL_UNSIGNED_BYTE, data);
+	}
 
-	// Nice trilinear filtering.
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
-	glGenerateMipmap(GL_TEXTURE_2D);
+	// Only the levels actually present are used
+	glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, texture.levels.size() - 1);
+
+	// Nice trilinear filtering when there is a mip chain
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, texture.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	if (target == GL_TEXTURE_3D){
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+	} else {
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
 
 	// Return the ID of the texture we just created
 	return textureID;
 }
 
+GLuint loadBMP_custom(const char * imagepath){
+	TextureData texture;
+	if (!decodeBMP(imagepath, texture)) return 0;
+	return uploadTexture(texture);
+}
+
+GLuint loadTGA_glfw(const char * imagepath){
+	TextureData texture;
+	if (!decodeTGA(imagepath, texture)) return 0;
+	return uploadTexture(texture);
+}
 
 
 #define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
 #define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
 #define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+#define FOURCC_ATI1 0x31495441 // Equivalent to "ATI1" in ASCII (BC4)
+#define FOURCC_BC4U 0x55344342 // Equivalent to "BC4U" in ASCII
+#define FOURCC_BC4S 0x53344342 // Equivalent to "BC4S" in ASCII
+#define FOURCC_ATI2 0x32495441 // Equivalent to "ATI2" in ASCII (BC5)
+#define FOURCC_BC5U 0x55354342 // Equivalent to "BC5U" in ASCII
+#define FOURCC_BC5S 0x53354342 // Equivalent to "BC5S" in ASCII
+
+#define DDPF_ALPHAPIXELS  0x00001
+#define DDPF_ALPHA        0x00002
+#define DDPF_FOURCC       0x00004
+#define DDPF_RGB          0x00040
+#define DDPF_LUMINANCE    0x20000
+#define DDSCAPS2_CUBEMAP  0x00200
+#define DDSCAPS2_VOLUME   0x200000
+
+// Maps the whole file read-only. Uses mmap where available, so the mip
+// levels can be handed to OpenGL straight from the page cache.
+static bool mapFile(const char * path, TextureData & texture){
+#ifdef _WIN32
+	FILE * fp = fopen(path, "rb");
+	if (fp == NULL) return false;
+	fseek(fp, 0, SEEK_END);
+	size_t size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	texture.storage.resize(size ? size : 1);
+	if (fread(&texture.storage[0], 1, size, fp) != size){
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+	texture.mappingSize = size;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0){
+		close(fd);
+		return false;
+	}
+	void * mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return false;
+	madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+	texture.mapping = (const unsigned char*)mapping;
+	texture.mappingSize = st.st_size;
+#endif
+	return true;
+}
 
-GLuint loadDDS(const char * imagepath){
+void freeTextureData(TextureData & texture){
+#ifndef _WIN32
+	if (texture.mapping) munmap((void*)texture.mapping, texture.mappingSize);
+#endif
+	texture.mapping = NULL;
+	texture.mappingSize = 0;
+	texture.storage.clear();
+	texture.levels.clear();
+}
 
-	unsigned char header[124];
+bool decodeDDS(const char * imagepath, TextureData & texture){
+
+	if (!mapFile(imagepath, texture)){
+		printf("%s could not be opened.\n", imagepath);
+		return false;
+	}
+	const unsigned char * file = textureBytes(texture);
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL) 
-		return 0; 
-   
 	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
+	if (texture.mappingSize < 128 || strncmp((const char*)file, "DDS ", 4) != 0) { 
+		printf("%s is not a DDS file\n", imagepath);
+		freeTextureData(texture);
+		return false; 
 	}
 	
 	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
+	const unsigned char * header = file + 4;
 
 	unsigned int height      = *(unsigned int*)&(header[8 ]);
 	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
+	unsigned int depth       = *(unsigned int*)&(header[20]);
 	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
+	unsigned int pfFlags     = *(unsigned int*)&(header[76]);
 	unsigned int fourCC      = *(unsigned int*)&(header[80]);
+	unsigned int bitCount    = *(unsigned int*)&(header[84]);
+	unsigned int rMask       = *(unsigned int*)&(header[88]);
+	unsigned int caps2       = *(unsigned int*)&(header[108]);
+
+	if (caps2 & DDSCAPS2_CUBEMAP){
+		printf("%s : DDS cube maps are not supported\n", imagepath);
+		freeTextureData(texture);
+		return false;
+	}
 
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
+	bool volume = (caps2 & DDSCAPS2_VOLUME) && depth > 0;
+	if (!volume) depth = 1;
+	if (width == 0 || height == 0){
+		printf("%s : empty DDS image\n", imagepath);
+		freeTextureData(texture);
+		return false;
+	}
 
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
-	switch(fourCC) 
-	{ 
-	case FOURCC_DXT1: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
-		break; 
-	case FOURCC_DXT3: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
-		break; 
-	case FOURCC_DXT5: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
-		break; 
-	default: 
-		free(buffer); 
-		return 0; 
+	// no more levels than down to 1x1x1, whatever the header says ; the
+	// file size is checked level by level below
+	unsigned int levels = 1;
+	while ((std::max(std::max(width, height), depth) >> levels) > 0) levels++;
+	if (mipMapCount == 0) mipMapCount = 1;
+	mipMapCount = std::min(mipMapCount, levels);
+
+	/* find out the pixel format */ 
+	unsigned int format = 0;         // compressed or uncompressed internal format
+	unsigned int pixelFormat = 0;    // uncompressed only
+	unsigned int blockSize = 0;      // compressed only : bytes per 4x4 block
+	unsigned int pixelSize = 0;      // uncompressed only : bytes per pixel
+
+	if (pfFlags & DDPF_FOURCC){
+		switch(fourCC) 
+		{ 
+		case FOURCC_DXT1: 
+			format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; blockSize = 8;
+			break; 
+		case FOURCC_DXT3: 
+			format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; blockSize = 16;
+			break; 
+		case FOURCC_DXT5: 
+			format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; blockSize = 16;
+			break; 
+		case FOURCC_ATI1: 
+		case FOURCC_BC4U: 
+			format = GL_COMPRESSED_RED_RGTC1; blockSize = 8;
+			break; 
+		case FOURCC_BC4S: 
+			format = GL_COMPRESSED_SIGNED_RED_RGTC1; blockSize = 8;
+			break; 
+		case FOURCC_ATI2: 
+		case FOURCC_BC5U: 
+			format = GL_COMPRESSED_RG_RGTC2; blockSize = 16;
+			break; 
+		case FOURCC_BC5S: 
+			format = GL_COMPRESSED_SIGNED_RG_RGTC2; blockSize = 16;
+			break; 
+		}
+	} else if ((pfFlags & DDPF_RGB) && bitCount == 32){
+		format = GL_RGBA8; pixelSize = 4;
+		pixelFormat = (rMask == 0x00ff0000) ? GL_BGRA : GL_RGBA;
+	} else if ((pfFlags & DDPF_RGB) && bitCount == 24){
+		format = GL_RGB8; pixelSize = 3;
+		pixelFormat = (rMask == 0x00ff0000) ? GL_BGR : GL_RGB;
+	} else if ((pfFlags & DDPF_LUMINANCE) && bitCount == 8){
+		format = GL_LUMINANCE8; pixelSize = 1; pixelFormat = GL_LUMINANCE;
+	} else if ((pfFlags & DDPF_LUMINANCE) && (pfFlags & DDPF_ALPHAPIXELS) && bitCount == 16){
+		format = GL_LUMINANCE8_ALPHA8; pixelSize = 2; pixelFormat = GL_LUMINANCE_ALPHA;
+	} else if ((pfFlags & DDPF_ALPHA) && bitCount == 8){
+		format = GL_ALPHA8; pixelSize = 1; pixelFormat = GL_ALPHA;
 	}
 
-	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
+	if (format == 0){
+		printf("%s : unsupported DDS pixel format\n", imagepath);
+		freeTextureData(texture);
+		return false;
+	}
 
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
-	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
-	unsigned int offset = 0;
+	// S3TC and RGTC are 2D formats : no GL implementation takes them as
+	// 3D textures
+	if (volume && blockSize){
+		printf("%s : compressed DDS volumes are not supported\n", imagepath);
+		freeTextureData(texture);
+		return false;
+	}
+
+	texture.target         = volume ? GL_TEXTURE_3D : GL_TEXTURE_2D;
+	texture.internalFormat = format;
+	texture.format         = pixelFormat;
 
-	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
+	size_t available = texture.mappingSize;
+	size_t offset = 128;
+
+	/* find the mipmaps inside the file */ 
+	for (unsigned int level = 0; level < mipMapCount; ++level) 
 	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
-	 
+		unsigned int w = std::max(1u, width  >> level);
+		unsigned int h = std::max(1u, height >> level);
+		unsigned int d = std::max(1u, depth  >> level);
+
+		// exact size of this level
+		size_t size = blockSize ? (size_t)((w+3)/4) * ((h+3)/4) * blockSize * d
+		                        : (size_t)w * h * d * pixelSize;
+		if (offset + size > available){
+			printf("%s : truncated DDS file, only %u mip levels loaded\n", imagepath, level);
+			break;
+		}
+
+		TextureLevel l = {w, h, d, offset, size};
+		texture.levels.push_back(l);
 		offset += size; 
-		width  /= 2; 
-		height /= 2; 
 	} 
 
-	free(buffer); 
+	if (texture.levels.empty()){
+		freeTextureData(texture);
+		return false;
+	}
+	return true;
+}
+
+GLuint loadDDS(const char * imagepath, GLenum * target){
+	TextureData texture;
+	if (!decodeDDS(imagepath, texture)) return 0;
 
+	// the levels are uploaded straight from the mapping
+	GLuint textureID = uploadTexture(texture);
+	if (target) *target = texture.target;
+	freeTextureData(texture);
 	return textureID;
+}
 
-
-}
\ No newline at end of file
+bool saveDDS(const char * imagepath, const TextureData & texture){
+
+	unsigned int pfFlags, bitCount, rMask = 0, gMask = 0, bMask = 0, aMask = 0;
+	switch (texture.format){
+	case GL_LUMINANCE:       pfFlags = DDPF_LUMINANCE; bitCount = 8; rMask = 0xff; break;
+	case GL_LUMINANCE_ALPHA: pfFlags = DDPF_LUMINANCE | DDPF_ALPHAPIXELS; bitCount = 16; rMask = 0xff; aMask = 0xff00; break;
+	case GL_ALPHA:           pfFlags = DDPF_ALPHA; bitCount = 8; aMask = 0xff; break;
+	case GL_BGR:             pfFlags = DDPF_RGB; bitCount = 24; rMask = 0xff0000; gMask = 0xff00; bMask = 0xff; break;
+	case GL_RGB:             pfFlags = DDPF_RGB; bitCount = 24; rMask = 0xff; gMask = 0xff00; bMask = 0xff0000; break;
+	case GL_BGRA:            pfFlags = DDPF_RGB | DDPF_ALPHAPIXELS; bitCount = 32; rMask = 0xff0000; gMask = 0xff00; bMask = 0xff; aMask = 0xff000000; break;
+	case GL_RGBA:            pfFlags = DDPF_RGB | DDPF_ALPHAPIXELS; bitCount = 32; rMask = 0xff; gMask = 0xff00; bMask = 0xff0000; aMask = 0xff000000; break;
+	default:
+		printf("%s : only uncompressed 8 bit images can be saved\n", imagepath);
+		return false;
+	}
+	if (texture.levels.empty()) return false;
+
+	bool volume = texture.target == GL_TEXTURE_3D;
+	const TextureLevel & top = texture.levels[0];
+
+	unsigned int header[31] = {0};
+	header[0]  = 124;                                       // size
+	header[1]  = 0x1 | 0x2 | 0x4 | 0x8 | 0x1000 | 0x20000; // caps, height, width, pitch, pixelformat, mipmapcount
+	if (volume) header[1] |= 0x800000;                      // depth
+	header[2]  = top.height;
+	header[3]  = top.width;
+	header[4]  = top.width * (bitCount / 8);                // pitch
+	header[5]  = volume ? top.depth : 0;
+	header[6]  = texture.levels.size();
+	header[18] = 32;                                        // pixel format size
+	header[19] = pfFlags;
+	header[21] = bitCount;
+	header[22] = rMask;
+	header[23] = gMask;
+	header[24] = bMask;
+	header[25] = aMask;
+	header[26] = 0x1000 | 0x8 | (texture.levels.size() > 1 ? 0x400000 : 0); // texture, complex, mipmap
+	header[27] = volume ? DDSCAPS2_VOLUME : 0;
+
+	FILE * fp = fopen(imagepath, "wb");
+	if (fp == NULL){
+		printf("%s could not be opened for writing\n", imagepath);
+		return false;
+	}
+	fwrite("DDS ", 1, 4, fp);
+	fwrite(header, 4, 31, fp);
+	const unsigned char * bytes = textureBytes(texture);
+	for (unsigned int i = 0; i < texture.levels.size(); i++)
+		fwrite(bytes + texture.levels[i].offset, 1, texture.levels[i].size, fp);
+	fclose(fp);
+	return true;
+}
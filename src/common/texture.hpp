@@ -1,14 +1,60 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
+#include <vector>
+#include <cstddef>
+
+#include "numa.hpp"
+
+// One mip level of a decoded image
+struct TextureLevel{
+	unsigned int width, height, depth;
+	size_t offset;   // from the start of the pixel data
+	size_t size;     // in bytes
+};
+
+// An image decoded on the CPU, ready to be handed to OpenGL.
+// Decoding does not touch OpenGL, so it can run on any thread ;
+// only uploadTexture must run on the GL thread.
+struct TextureData{
+	GLenum target;           // GL_TEXTURE_2D or GL_TEXTURE_3D
+	GLenum internalFormat;
+	GLenum format;           // 0 for compressed data
+	std::vector<TextureLevel> levels;
+	NumaBytes storage;                   // decoded pixels, unless mapped ;
+	                                     // interleaved over the NUMA nodes
+	const unsigned char * mapping;       // DDS files stay mapped until freed
+	size_t mappingSize;
+
+	TextureData() : target(0), internalFormat(0), format(0), mapping(NULL), mappingSize(0) {}
+};
+
+// Decode an image without uploading it. BMP and TGA images come with
+// their full mip chain, built on the CPU.
+bool decodeBMP(const char * imagepath, TextureData & texture);
+bool decodeTGA(const char * imagepath, TextureData & texture);
+bool decodeDDS(const char * imagepath, TextureData & texture);
+
+// Upload a decoded image into a new OpenGL texture
+GLuint uploadTexture(const TextureData & texture);
+
+// Save an uncompressed image and all its mip levels as a .DDS file,
+// which loadDDS and decodeDDS read back as is.
+bool saveDDS(const char * imagepath, const TextureData & texture);
+
+// Release the memory or the file mapping held by a decoded image
+void freeTextureData(TextureData & texture);
+
 // Load a .BMP file using our custom loader
 GLuint loadBMP_custom(const char * imagepath);
 
 // Load a .TGA file using GLFW's own loader
 GLuint loadTGA_glfw(const char * imagepath);
 
-// Load a .DDS file using GLFW's own loader
-GLuint loadDDS(const char * imagepath);
+// Load a .DDS file using our custom loader. Handles 2D and volume (3D)
+// textures, DXT1/3/5, BC4/BC5 and uncompressed 8 bit formats.
+// If target is given, it receives GL_TEXTURE_2D or GL_TEXTURE_3D.
+GLuint loadDDS(const char * imagepath, GLenum * target = NULL);
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <sys/stat.h>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "texturecache.hpp"
+#include "parallel.hpp"
+
+SharedTexture::~SharedTexture(){
+	glDeleteTextures(1, &id);
+}
+
+namespace texturecache{
+
+	// An image on its way from the disk to OpenGL
+	struct Job{
+		TextureHandle handle;
+		TextureData data;
+		unsigned long long hash;
+		bool ok;
+	};
+
+	static std::vector<std::thread> workers;
+	static std::mutex mutex;
+	static std::condition_variable wake;      // new decode requests, or shutdown
+	static std::condition_variable decoded;   // a job moved to the upload queue
+	static std::deque<std::shared_ptr<Job> > decodeQueue;
+	static std::deque<std::shared_ptr<Job> > uploadQueue;
+	static int inFlight = 0;
+	static bool stopping = false;
+
+	// path -> handle, and content hash -> GL texture. Both are weak so
+	// that releasing the last handle frees the texture.
+	static std::map<std::string, std::weak_ptr<CachedTexture> > byPath;
+	static std::map<unsigned long long, std::weak_ptr<SharedTexture> > byContent;
+
+	// 64 bit FNV-1a
+	static unsigned long long hashBytes(const unsigned char * data, size_t size, unsigned long long h){
+		for (size_t i = 0; i < size; i++){
+			h ^= data[i];
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	static unsigned long long hashTexture(const TextureData & texture){
+		unsigned long long h = 14695981039346656037ULL;
+		unsigned int format[3] = {texture.target, texture.internalFormat, texture.format};
+		h = hashBytes((const unsigned char*)format, sizeof(format), h);
+		const unsigned char * bytes = texture.mapping ? texture.mapping : &texture.storage[0];
+		for (unsigned int i = 0; i < texture.levels.size(); i++){
+			const TextureLevel & l = texture.levels[i];
+			unsigned int size[3] = {l.width, l.height, l.depth};
+			h = hashBytes((const unsigned char*)size, sizeof(size), h);
+			h = hashBytes(bytes + l.offset, l.size, h);
+		}
+		return h;
+	}
+
+	static bool hasExtension(const std::string & path, const char * ext){
+		size_t n = strlen(ext);
+		if (path.size() < n) return false;
+		std::string tail = path.substr(path.size() - n);
+		std::transform(tail.begin(), tail.end(), tail.begin(), ::tolower);
+		return tail == ext;
+	}
+
+	// True if path exists and is at least as recent as source
+	static bool upToDate(const std::string & path, const std::string & source){
+		struct stat cached, original;
+		if (stat(path.c_str(), &cached) != 0) return false;
+		if (stat(source.c_str(), &original) != 0) return true;
+		return cached.st_mtime >= original.st_mtime;
+	}
+
+	static void decode(Job & job){
+		const std::string & path = job.handle->path;
+		if (hasExtension(path, ".dds")){
+			job.ok = decodeDDS(path.c_str(), job.data);
+		} else if (hasExtension(path, ".tga") || hasExtension(path, ".bmp")){
+			// BMP and TGA mip chains are built once and kept next to
+			// the image as an uncompressed .mips.dds file
+			std::string cache = path + ".mips.dds";
+			job.ok = upToDate(cache, path) && decodeDDS(cache.c_str(), job.data);
+			if (!job.ok){
+				job.data = TextureData();
+				if (hasExtension(path, ".tga"))
+					job.ok = decodeTGA(path.c_str(), job.data);
+				else
+					job.ok = decodeBMP(path.c_str(), job.data);
+				if (job.ok)
+					saveDDS(cache.c_str(), job.data);
+			}
+		} else {
+			printf("%s : unknown texture format\n", path.c_str());
+			job.ok = false;
+		}
+		if (job.ok)
+			job.hash = hashTexture(job.data);
+	}
+
+	static void worker(){
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true){
+			wake.wait(lock, []{ return stopping || !decodeQueue.empty(); });
+			if (stopping) return;
+			std::shared_ptr<Job> job = decodeQueue.front();
+			decodeQueue.pop_front();
+
+			lock.unlock();
+			decode(*job);
+			lock.lock();
+
+			uploadQueue.push_back(job);
+			decoded.notify_all();
+		}
+	}
+
+	void init(int threads){
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!workers.empty()) return;
+		stopping = false;
+		if (threads <= 0) threads = parallel_threads();
+		for (int i = 0; i < threads; i++)
+			workers.push_back(std::thread(worker));
+	}
+
+	void shutdown(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			decodeQueue.clear();
+		}
+		wake.notify_all();
+		for (auto & w : workers)
+			w.join();
+		workers.clear();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto & job : uploadQueue)
+			freeTextureData(job->data);
+		uploadQueue.clear();
+		inFlight = 0;
+	}
+
+	TextureHandle load(const std::string & path){
+		if (workers.empty()) init();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		TextureHandle handle = byPath[path].lock();
+		if (handle) return handle;
+
+		handle = TextureHandle(new CachedTexture(path));
+		byPath[path] = handle;
+
+		std::shared_ptr<Job> job(new Job());
+		job->handle = handle;
+		job->hash = 0;
+		job->ok = false;
+		decodeQueue.push_back(job);
+		inFlight++;
+		wake.notify_one();
+		return handle;
+	}
+
+	// Uploads one decoded job, reusing an identical texture if one is alive
+	static void upload(Job & job){
+		if (!job.ok){
+			job.handle->failed = true;
+			return;
+		}
+		std::shared_ptr<SharedTexture> texture = byContent[job.hash].lock();
+		if (!texture){
+			texture = std::shared_ptr<SharedTexture>(new SharedTexture(uploadTexture(job.data), job.data.target));
+			byContent[job.hash] = texture;
+		}
+		freeTextureData(job.data);
+		job.handle->texture = texture;
+	}
+
+	int pump(int maxUploads){
+		int uploaded = 0;
+		while (maxUploads < 0 || uploaded < maxUploads){
+			std::shared_ptr<Job> job;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (uploadQueue.empty()) break;
+				job = uploadQueue.front();
+				uploadQueue.pop_front();
+			}
+			upload(*job);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				inFlight--;
+			}
+			uploaded++;
+		}
+		return uploaded;
+	}
+
+	TextureHandle loadNow(const std::string & path){
+		TextureHandle handle = load(path);
+		while (!handle->ready() && !handle->failed){
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				decoded.wait(lock, []{ return !uploadQueue.empty() || inFlight == 0; });
+			}
+			if (pump() == 0 && pending() == 0) break;
+		}
+		return handle;
+	}
+
+	void finish(){
+		while (pending() > 0){
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				decoded.wait(lock, []{ return !uploadQueue.empty() || inFlight == 0; });
+			}
+			pump();
+		}
+	}
+
+	int pending(){
+		std::lock_guard<std::mutex> lock(mutex);
+		return inFlight;
+	}
+}
@@ -0,0 +1,61 @@
+#ifndef TEXTURECACHE_HPP
+#define TEXTURECACHE_HPP
+
+#include <memory>
+#include <string>
+
+// An OpenGL texture shared by every handle that refers to the same image.
+// It is deleted when the last handle goes away, which must happen on the
+// GL thread.
+struct SharedTexture{
+	GLuint id;
+	GLenum target;
+	SharedTexture(GLuint id, GLenum target) : id(id), target(target) {}
+	~SharedTexture();
+};
+
+// A texture requested from the cache. texture stays empty until the
+// image has been decoded by a worker and uploaded by texturecache::pump().
+struct CachedTexture{
+	std::string path;
+	std::shared_ptr<SharedTexture> texture;
+	bool failed;
+
+	CachedTexture(const std::string & path) : path(path), failed(false) {}
+	bool ready() const { return texture != NULL; }
+	GLuint id() const { return texture ? texture->id : 0; }
+};
+
+typedef std::shared_ptr<CachedTexture> TextureHandle;
+
+namespace texturecache{
+
+	// Starts the decode workers (0 : one per core)
+	void init(int threads = 0);
+
+	// Stops the workers and drops every pending request
+	void shutdown();
+
+	// Requests a texture ; .bmp, .tga and .dds files are recognized by
+	// their extension. Returns at once. Requests for a path that is
+	// already loaded or in flight return the same handle.
+	TextureHandle load(const std::string & path);
+
+	// Same as load, but waits until the texture is usable.
+	// Must be called on the GL thread.
+	TextureHandle loadNow(const std::string & path);
+
+	// Uploads up to maxUploads decoded images (all of them if negative).
+	// Must be called regularly on the GL thread. Returns the number of
+	// textures uploaded.
+	int pump(int maxUploads = -1);
+
+	// Waits for every pending request and uploads it.
+	// Must be called on the GL thread.
+	void finish();
+
+	// Number of requests not uploaded yet
+	int pending();
+}
+
+#endif
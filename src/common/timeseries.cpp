@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <GL/glew.h>
+
+#include "timeseries.hpp"
+
+namespace timeseries{
+
+	typedef std::chrono::steady_clock Clock;
+
+	static std::vector<std::string> files;
+	static std::deque<Frame> queue;
+	static int capacity = 0;
+	static int readahead = 0;
+	static std::thread reader;
+	static bool stopping = false;
+	static std::mutex mutex;
+	static std::condition_variable space;   // the queue has room, or stopping
+
+	// the playback clock starts with the first frame decoded
+	static bool started = false;
+	static Clock::time_point clockStart;
+	static Clock::time_point opened;
+	static long clockFrame = 0;             // frame due at clockStart
+	static double fps = 24;
+
+	static long lastShown = -1;
+	static long lateFrame = -1;
+	static long shownSinceStart = 0;
+	static double bytesRead = 0;
+	static Stats counters;
+
+	static double seconds(Clock::time_point from){
+		return std::chrono::duration<double>(Clock::now() - from).count();
+	}
+
+	// frame the clock is at ; call with the lock held
+	static long dueFrame(){
+		if (!started) return 0;
+		return clockFrame + (long)(seconds(clockStart) * fps);
+	}
+
+	static void willNeed(const std::string & path){
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		::close(fd);
+	}
+
+	// touches every page, so the GL thread copies from memory, not disk
+	static void pageIn(const TextureData & data){
+		volatile unsigned char sink = 0;
+		for (size_t i = 0; i < data.mappingSize; i += 4096)
+			sink += data.mapping[i];
+	}
+
+	static void readFrames(){
+		long index = 0;
+		long advised = 0;   // files before this one were handed to the kernel
+		int n = (int)files.size();
+		while (true){
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				space.wait(lock, [](){ return stopping || (int)queue.size() < capacity; });
+				if (stopping) return;
+				// behind the clock : frames already due would be dropped anyway
+				index = std::max(index, dueFrame());
+			}
+
+			for (advised = std::max(advised, index + 1); advised <= index + readahead; advised++)
+				willNeed(files[advised % n]);
+
+			Frame frame;
+			frame.index = index;
+			frame.file = (int)(index % n);
+			index++;
+			if (!decodeDDS(files[frame.file].c_str(), frame.data))
+				continue;
+			pageIn(frame.data);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			bytesRead += frame.data.mappingSize;
+			if (stopping){
+				freeTextureData(frame.data);
+				return;
+			}
+			queue.push_back(std::move(frame));
+		}
+	}
+
+	static bool isVolumeFile(const char * name){
+		size_t length = strlen(name);
+		return length > 4 && strcasecmp(name + length - 4, ".dds") == 0;
+	}
+
+	bool open(const std::string & directory, double framesPerSecond, int queueFrames, int readaheadFiles){
+		close();
+
+		DIR * dir = opendir(directory.c_str());
+		if (!dir) return false;
+		files.clear();
+		while (dirent * entry = readdir(dir))
+			if (isVolumeFile(entry->d_name))
+				files.push_back(directory + "/" + entry->d_name);
+		closedir(dir);
+		std::sort(files.begin(), files.end());
+		if (files.empty()) return false;
+
+		capacity = std::max(queueFrames, 1);
+		readahead = std::max(readaheadFiles, 0);
+		fps = framesPerSecond > 0 ? framesPerSecond : 24;
+		started = false;
+		clockFrame = 0;
+		lastShown = -1;
+		lateFrame = -1;
+		shownSinceStart = 0;
+		bytesRead = 0;
+		counters = Stats();
+		opened = Clock::now();
+		stopping = false;
+		reader = std::thread(readFrames);
+		return true;
+	}
+
+	void close(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		space.notify_all();
+		if (reader.joinable())
+			reader.join();
+		for (auto & frame : queue)
+			freeTextureData(frame.data);
+		queue.clear();
+		files.clear();
+	}
+
+	bool isOpen(){
+		return !files.empty();
+	}
+
+	void setFrameRate(double framesPerSecond){
+		std::lock_guard<std::mutex> lock(mutex);
+		if (framesPerSecond <= 0) return;
+		if (started){
+			clockFrame = lastShown + 1;
+			clockStart = Clock::now();
+		}
+		fps = framesPerSecond;
+		shownSinceStart = 0;
+	}
+
+	bool next(Frame & frame){
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!started){
+			if (queue.empty()) return false;
+			started = true;
+			clockStart = Clock::now();
+			clockFrame = queue.front().index;
+		}
+
+		long due = dueFrame();
+		bool found = false;
+		// the newest frame due ; older ones are overtaken
+		while (!queue.empty() && queue.front().index <= due){
+			if (found) freeTextureData(frame.data);
+			frame = std::move(queue.front());
+			queue.pop_front();
+			found = true;
+		}
+
+		if (found){
+			counters.dropped += frame.index - lastShown - 1;
+			counters.shown++;
+			shownSinceStart++;
+			lastShown = frame.index;
+			space.notify_one();
+		} else if (due > lastShown && due != lateFrame){
+			counters.late++;
+			lateFrame = due;
+		}
+		return found;
+	}
+
+	Stats stats(){
+		std::lock_guard<std::mutex> lock(mutex);
+		Stats s = counters;
+		double open = seconds(opened);
+		double playing = started ? seconds(clockStart) : 0;
+		s.files = (int)files.size();
+		s.queued = (int)queue.size();
+		s.capacity = capacity;
+		s.targetFps = fps;
+		s.shownFps = playing > 0 ? shownSinceStart / playing : 0;
+		s.readMBps = open > 0 ? bytesRead / open / (1 << 20) : 0;
+		return s;
+	}
+}
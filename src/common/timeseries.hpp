@@ -0,0 +1,54 @@
+#ifndef TIMESERIES_HPP
+#define TIMESERIES_HPP
+
+#include <string>
+
+#include "texture.hpp"
+
+// A recorded simulation played back from a directory of volume files
+// (.dds, one per time step, in file name order), looping. An I/O thread
+// decodes the frames in order into a bounded queue ; the files further
+// ahead are handed to the kernel to read ahead meanwhile. The GL thread
+// takes the frame due at the target frame rate : frames it is too late
+// for are dropped, and skipped by the I/O thread when it is behind.
+namespace timeseries{
+
+	struct Frame{
+		long index;         // position in the playback, counting the loops
+		int file;           // which file of the directory
+		TextureData data;   // mapped, paged in
+	};
+
+	struct Stats{
+		int    files;
+		int    queued;          // decoded, not taken yet
+		int    capacity;        // of the queue
+		double targetFps;
+		double shownFps;        // frames actually taken, per second
+		double readMBps;        // from the disk, since open
+		long   shown;
+		long   dropped;         // frames due that were never taken
+		long   late;            // times the due frame was not decoded yet
+	};
+
+	// Starts playing the .dds files of directory at fps frames per second,
+	// decoding up to queueFrames ahead and asking the kernel to read
+	// readahead more files. Returns false if there is no volume file.
+	bool open(const std::string & directory, double fps, int queueFrames = 4, int readahead = 8);
+
+	// Stops the I/O thread and drops the frames not taken
+	void close();
+
+	bool isOpen();
+
+	// Restarts the clock at the current frame with another frame rate
+	void setFrameRate(double fps);
+
+	// The frame due now, if it is not the one taken last. Never waits.
+	// The caller owns frame.data and frees it with freeTextureData.
+	bool next(Frame & frame);
+
+	Stats stats();
+}
+
+#endif
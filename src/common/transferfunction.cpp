@@ -0,0 +1,77 @@
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include "transferfunction.hpp"
+#include "parallel.hpp"
+
+void initTransferFunction(TransferFunction & tf, float step, int threshold){
+	tf.step = step;
+	for (int i = 0; i < TF_SIZE; i++){
+		float v = i / (float)(TF_SIZE - 1);
+		tf.color[i][0] = tf.color[i][1] = tf.color[i][2] = v;
+		tf.extinction[i] = i < threshold ? 0.0f : 8.0f * v;
+	}
+	tf.table.assign(TF_SIZE * TF_SIZE * 4, 0);
+	updatePreintegration(tf, 0, TF_SIZE - 1);
+}
+
+void setTransferFunctionThreshold(TransferFunction & tf, int old_threshold, int threshold){
+	old_threshold = std::min(std::max(old_threshold, 0), TF_SIZE);
+	threshold     = std::min(std::max(threshold, 0), TF_SIZE);
+	int first = std::min(old_threshold, threshold);
+	int last  = std::max(old_threshold, threshold);
+	if (first == last) return;
+	for (int i = first; i < last; i++)
+		tf.extinction[i] = i < threshold ? 0.0f : 8.0f * i / (float)(TF_SIZE - 1);
+	updatePreintegration(tf, first, last - 1);
+}
+
+void updatePreintegration(TransferFunction & tf, int first, int last){
+
+	// 1. prefix sums (trapezoid rule) of extinction and extinction * color
+	for (int c = 0; c < 4; c++)
+		tf.integral[c].resize(TF_SIZE);
+	tf.integral[0][0] = tf.integral[1][0] = tf.integral[2][0] = tf.integral[3][0] = 0;
+	for (int i = 1; i < TF_SIZE; i++){
+		tf.integral[3][i] = tf.integral[3][i-1] + 0.5 * (tf.extinction[i-1] + tf.extinction[i]);
+		for (int c = 0; c < 3; c++)
+			tf.integral[c][i] = tf.integral[c][i-1] + 0.5 * (tf.extinction[i-1] * tf.color[i-1][c] + tf.extinction[i] * tf.color[i][c]);
+	}
+
+	// 2. table entries : a segment from density f to density b only
+	// changes if [min(f,b), max(f,b)] touches the edited range ; the
+	// trapezoids reach one entry further on each side
+	first = std::max(first - 1, 0);
+	last  = std::min(last + 1, TF_SIZE - 1);
+	float step = tf.step;
+
+	parallel_for(0, TF_SIZE, [&](int row_first, int row_last){
+		float alpha[TF_SIZE], rgb[3][TF_SIZE];
+		for (int b = row_first; b < row_last; b++){
+			// when the back density is below the edit, only fronts above
+			// it can cross the edited range, and the other way round
+			int f0 = b < first ? first : 0;
+			int f1 = b > last  ? last  : TF_SIZE - 1;
+
+			const double * T = &tf.integral[3][0];
+			for (int f = f0; f <= f1; f++){
+				int   d  = b - f;
+				float scale = d != 0 ? step / d : 0.0f;
+				float tau = d != 0 ? (float)(T[b] - T[f]) * scale : tf.extinction[f] * step;
+				alpha[f] = 1.0f - expf(-tau);
+				for (int c = 0; c < 3; c++){
+					const double * K = &tf.integral[c][0];
+					rgb[c][f] = d != 0 ? (float)(K[b] - K[f]) * scale : tf.extinction[f] * tf.color[f][c] * step;
+				}
+			}
+
+			unsigned char * out = &tf.table[(size_t)b * TF_SIZE * 4];
+			for (int f = f0; f <= f1; f++){
+				for (int c = 0; c < 3; c++)
+					out[4*f+c] = (unsigned char)(std::min(std::max(rgb[c][f], 0.0f), 1.0f) * 255.0f + 0.5f);
+				out[4*f+3] = (unsigned char)(std::min(std::max(alpha[f], 0.0f), 1.0f) * 255.0f + 0.5f);
+			}
+		}
+	});
+}
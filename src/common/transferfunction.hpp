@@ -0,0 +1,39 @@
+#ifndef TRANSFERFUNCTION_HPP
+#define TRANSFERFUNCTION_HPP
+
+#include <vector>
+
+#define TF_SIZE 256
+
+// A 1D transfer function over 8 bit densities, and its pre-integrated
+// lookup table : entry (front, back) holds the color and opacity of a
+// whole ray segment going linearly from density front to density back,
+// so the ray loop no longer treats each step as a point sample.
+struct TransferFunction{
+	float color[TF_SIZE][3];        // emitted color
+	float extinction[TF_SIZE];      // opacity per unit of ray length
+	float step;                     // segment length the table is built for
+
+	// running integrals of extinction and extinction * color
+	std::vector<double> integral[4];
+
+	// TF_SIZE * TF_SIZE RGBA8 texels, premultiplied color, front density
+	// varying fastest
+	std::vector<unsigned char> table;
+};
+
+// Grayscale ramp : color and extinction grow with density, and densities
+// below threshold are fully transparent. Builds the whole table.
+void initTransferFunction(TransferFunction & tf, float step, int threshold = 0);
+
+// Moves the transparent threshold of the ramp, and only rebuilds the
+// part of the table affected by the edit.
+void setTransferFunctionThreshold(TransferFunction & tf, int old_threshold, int threshold);
+
+// Rebuilds the table entries whose segment crosses densities
+// [first, last], after color / extinction were edited there.
+// The integrals are recomputed in O(TF_SIZE), the table in
+// O(TF_SIZE^2) at most, rows in parallel.
+void updatePreintegration(TransferFunction & tf, int first, int last);
+
+#endif
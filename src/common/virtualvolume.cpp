@@ -0,0 +1,341 @@
+#include <math.h>
+#include <vector>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "virtualvolume.hpp"
+#include "parallel.hpp"
+
+namespace virtualvolume{
+
+	enum BrickState{
+		BRICK_MISSING,
+		BRICK_PENDING,
+		BRICK_RESIDENT,
+		BRICK_EMPTY,
+		BRICK_REJECTED
+	};
+
+	struct Brick{
+		unsigned char state;
+		int slot;
+	};
+
+	// A brick on its way from a worker to the atlas
+	struct Job{
+		int brick;
+		unsigned int epoch;
+		std::vector<unsigned char> voxels;
+		bool empty;
+		// the generator when the brick was requested : the one current
+		// then may be replaced by reset meanwhile
+		std::shared_ptr<const BrickGenerator> generate;
+	};
+
+	static int volumeSize = 0, brick = 0, pagesPerSide = 0, slotsPerSide = 0;
+	static std::shared_ptr<const BrickGenerator> generator;
+	static BrickReject rejecter;
+	static GLuint pageTex = 0, atlasTex = 0;
+
+	// GL thread only
+	static std::vector<Brick> bricks;            // x slowest, z fastest
+	static std::vector<int> slotOwner;           // brick in each slot, or -1
+	static std::vector<unsigned int> slotUsed;   // last frame each slot was visible
+	static unsigned int frame = 0;
+	static Stats counters = {0, 0, 0, 0, 0, 0};
+
+	static std::vector<std::thread> workers;
+	static std::mutex mutex;
+	static std::condition_variable wake;
+	static std::deque<std::shared_ptr<Job> > requestQueue;
+	static std::deque<std::shared_ptr<Job> > doneQueue;
+	static unsigned int epoch = 0;              // bumped by reset, guarded by mutex
+	static bool stopping = false;
+
+	static void worker(){
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true){
+			wake.wait(lock, []{ return stopping || !requestQueue.empty(); });
+			if (stopping) return;
+			std::shared_ptr<Job> job = requestQueue.front();
+			requestQueue.pop_front();
+
+			lock.unlock();
+			int b = job->brick;
+			int x = b / (pagesPerSide*pagesPerSide), y = (b / pagesPerSide) % pagesPerSide, z = b % pagesPerSide;
+			int apron = brick + 2;
+			job->voxels.resize((size_t)apron*apron*apron);
+			(*job->generate)(x*brick - 1, y*brick - 1, z*brick - 1, brick, &job->voxels[0]);
+			job->empty = std::find_if(job->voxels.begin(), job->voxels.end(),
+				[](unsigned char v){ return v != 0; }) == job->voxels.end();
+			lock.lock();
+
+			doneQueue.push_back(job);
+		}
+	}
+
+	static void setPage(int b, const unsigned char entry[4]){
+		int x = b / (pagesPerSide*pagesPerSide), y = (b / pagesPerSide) % pagesPerSide, z = b % pagesPerSide;
+		glBindTexture(GL_TEXTURE_3D, pageTex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage3D(GL_TEXTURE_3D, 0, z, y, x, 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, entry);
+	}
+
+	// marks every brick missing, or rejected, and clears the page texture
+	static void forgetBricks(){
+		int count = pagesPerSide*pagesPerSide*pagesPerSide;
+		bricks.assign(count, Brick());
+		parallel_for(0, count, [&](int first, int last){
+			for (int b = first; b < last; b++){
+				int x = b / (pagesPerSide*pagesPerSide), y = (b / pagesPerSide) % pagesPerSide, z = b % pagesPerSide;
+				glm::ivec3 min(x*brick, y*brick, z*brick);
+				bool rejected = rejecter && rejecter(min, min + glm::ivec3(brick));
+				bricks[b].state = rejected ? BRICK_REJECTED : BRICK_MISSING;
+				bricks[b].slot = -1;
+			}
+		});
+		counters.rejected = (int)std::count_if(bricks.begin(), bricks.end(),
+			[](const Brick & b){ return b.state == BRICK_REJECTED; });
+		counters.resident = counters.empty = 0;
+
+		std::fill(slotOwner.begin(), slotOwner.end(), -1);
+		std::fill(slotUsed.begin(), slotUsed.end(), 0);
+
+		std::vector<unsigned char> pages((size_t)count*4, 0);
+		glBindTexture(GL_TEXTURE_3D, pageTex);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, pagesPerSide, pagesPerSide, pagesPerSide, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pages[0]);
+	}
+
+	void init(int size, int brickSize, int capacity, BrickGenerator generate, BrickReject reject, int threads){
+		shutdown();
+
+		volumeSize   = size;
+		brick        = brickSize;
+		pagesPerSide = (size + brickSize - 1) / brickSize;
+		slotsPerSide = std::max(1, (int)ceil(pow((double)capacity, 1.0/3.0) - 1e-9));
+		generator    = std::make_shared<const BrickGenerator>(generate);
+		rejecter     = reject;
+		slotOwner.assign(slotsPerSide*slotsPerSide*slotsPerSide, -1);
+		slotUsed.assign(slotOwner.size(), 0);
+		Stats none = {0, 0, 0, 0, 0, 0};
+		counters = none;
+		frame = 0;
+
+		glGenTextures(1, &pageTex);
+		glBindTexture(GL_TEXTURE_3D, pageTex);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+		int atlas = atlasSize();
+		glGenTextures(1, &atlasTex);
+		glBindTexture(GL_TEXTURE_3D, atlasTex);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_LUMINANCE8, atlas, atlas, atlas, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+
+		forgetBricks();
+
+		stopping = false;
+		if (threads <= 0) threads = parallel_threads();
+		for (int i = 0; i < threads; i++)
+			workers.push_back(std::thread(worker));
+	}
+
+	void stop(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			requestQueue.clear();
+		}
+		wake.notify_all();
+		for (auto & w : workers)
+			w.join();
+		workers.clear();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		doneQueue.clear();
+		epoch++;
+	}
+
+	void shutdown(){
+		stop();
+
+		if (pageTex)  glDeleteTextures(1, &pageTex);
+		if (atlasTex) glDeleteTextures(1, &atlasTex);
+		pageTex = atlasTex = 0;
+		bricks.clear();
+		counters.pending = 0;
+	}
+
+	void reset(BrickGenerator generate, BrickReject reject){
+		if (!pageTex) return;
+		generator = std::make_shared<const BrickGenerator>(generate);
+		rejecter  = reject;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requestQueue.clear();
+			doneQueue.clear();
+			epoch++;
+		}
+		counters.pending = 0;
+		forgetBricks();
+	}
+
+	void update(const glm::mat4 & mvp, const glm::vec3 & eye, int maxRequests){
+		if (!pageTex) return;
+		frame++;
+
+		// frustum test of every brick that may hold something : the brick
+		// is out if all its corners are beyond the same clip plane
+		int count = (int)bricks.size();
+		float scale = (float)brick / volumeSize;
+		std::vector< std::vector<std::pair<float,int> > > found(parallel_threads());
+		parallel_chunks(0, count, (int)found.size(), [&](int first, int last, int chunk){
+			for (int b = first; b < last; b++){
+				Brick & br = bricks[b];
+				if (br.state != BRICK_MISSING && br.state != BRICK_RESIDENT) continue;
+				int x = b / (pagesPerSide*pagesPerSide), y = (b / pagesPerSide) % pagesPerSide, z = b % pagesPerSide;
+				glm::vec3 min = glm::vec3(z, y, x) * scale;
+
+				int outside[6] = {0, 0, 0, 0, 0, 0};
+				for (int c = 0; c < 8; c++){
+					glm::vec3 corner = min + glm::vec3(c & 1, (c >> 1) & 1, (c >> 2) & 1) * scale;
+					glm::vec4 p = mvp * glm::vec4(corner, 1.0f);
+					outside[0] += p.x < -p.w;
+					outside[1] += p.x >  p.w;
+					outside[2] += p.y < -p.w;
+					outside[3] += p.y >  p.w;
+					outside[4] += p.z < -p.w;
+					outside[5] += p.z >  p.w;
+				}
+				if (*std::max_element(outside, outside + 6) == 8) continue;
+
+				if (br.state == BRICK_RESIDENT){
+					slotUsed[br.slot] = frame;
+				} else {
+					glm::vec3 center = min + glm::vec3(0.5f * scale);
+					glm::vec3 d = center - eye;
+					found[chunk].push_back(std::make_pair(glm::dot(d, d), b));
+				}
+			}
+		});
+
+		std::vector<std::pair<float,int> > missing;
+		for (auto & list : found)
+			missing.insert(missing.end(), list.begin(), list.end());
+		// no more in flight than the atlas can take without evicting
+		// bricks in view, which would only be requested again
+		int free = 0;
+		for (size_t i = 0; i < slotOwner.size(); i++)
+			free += slotOwner[i] < 0 || slotUsed[i] < frame;
+		int room = std::min(maxRequests, free - counters.pending);
+		if (room <= 0 || missing.empty()) return;
+		size_t requested = std::min(missing.size(), (size_t)room);
+		std::partial_sort(missing.begin(), missing.begin() + requested, missing.end());
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t i = 0; i < requested; i++){
+				std::shared_ptr<Job> job(new Job());
+				job->brick = missing[i].second;
+				job->epoch = epoch;
+				job->empty = false;
+				job->generate = generator;
+				requestQueue.push_back(job);
+				bricks[job->brick].state = BRICK_PENDING;
+			}
+		}
+		counters.pending += (int)requested;
+		wake.notify_all();
+	}
+
+	// a free slot, or the least recently used one not visible this frame
+	static int acquireSlot(){
+		int best = -1;
+		for (int s = 0; s < (int)slotOwner.size(); s++){
+			if (slotOwner[s] < 0) return s;
+			if (slotUsed[s] < frame && (best < 0 || slotUsed[s] < slotUsed[best]))
+				best = s;
+		}
+		if (best >= 0){
+			int owner = slotOwner[best];
+			bricks[owner].state = BRICK_MISSING;
+			bricks[owner].slot = -1;
+			unsigned char none[4] = {0, 0, 0, 0};
+			setPage(owner, none);
+			slotOwner[best] = -1;
+			counters.resident--;
+			counters.evicted++;
+		}
+		return best;
+	}
+
+	int pump(int maxUploads){
+		int uploaded = 0;
+		while (maxUploads < 0 || uploaded < maxUploads){
+			std::shared_ptr<Job> job;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (doneQueue.empty()) break;
+				job = doneQueue.front();
+				doneQueue.pop_front();
+				if (job->epoch != epoch) continue;
+			}
+			counters.pending--;
+			counters.generated++;
+			Brick & br = bricks[job->brick];
+
+			if (job->empty){
+				br.state = BRICK_EMPTY;
+				counters.empty++;
+				continue;
+			}
+			int slot = acquireSlot();
+			if (slot < 0){
+				// everything resident is in view : try again later
+				br.state = BRICK_MISSING;
+				continue;
+			}
+
+			int ss = slot % slotsPerSide, st = (slot / slotsPerSide) % slotsPerSide, sr = slot / (slotsPerSide*slotsPerSide);
+			int apron = brick + 2;
+			glBindTexture(GL_TEXTURE_3D, atlasTex);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage3D(GL_TEXTURE_3D, 0, ss*apron, st*apron, sr*apron, apron, apron, apron,
+				GL_LUMINANCE, GL_UNSIGNED_BYTE, &job->voxels[0]);
+
+			unsigned char entry[4] = {(unsigned char)ss, (unsigned char)st, (unsigned char)sr, 255};
+			setPage(job->brick, entry);
+			br.state = BRICK_RESIDENT;
+			br.slot = slot;
+			slotOwner[slot] = job->brick;
+			slotUsed[slot] = frame;
+			counters.resident++;
+			uploaded++;
+		}
+		return uploaded;
+	}
+
+	GLuint pageTexture(){ return pageTex; }
+	GLuint atlasTexture(){ return atlasTex; }
+	int size(){ return volumeSize; }
+	int pages(){ return pagesPerSide; }
+	int brickSize(){ return brick; }
+	int atlasSize(){ return slotsPerSide * (brick + 2); }
+
+	Stats stats(){ return counters; }
+}
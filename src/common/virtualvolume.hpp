@@ -0,0 +1,77 @@
+#ifndef VIRTUALVOLUME_HPP
+#define VIRTUALVOLUME_HPP
+
+#include <functional>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// A volume too large to generate up front, made of bricks produced on
+// demand by worker threads. Resident bricks live in an atlas texture ;
+// a page texture holds, for every brick of the volume, its slot in the
+// atlas (RGB, in slots along s, t and r) and whether it is resident (A).
+// Voxel (x,y,z) of the volume is texel (s,t,r) = (z,y,x), as in the
+// buffers handed to glTexImage3D.
+namespace virtualvolume{
+
+	// Fills out with the voxels [x,x+size+2) * [y,y+size+2) * [z,z+size+2),
+	// z fastest : a brick and the one voxel apron linear filtering needs.
+	// Called on the worker threads, so it must hold copies of whatever it
+	// reads that the GL thread may change.
+	typedef std::function<void(int x, int y, int z, int size, unsigned char * out)> BrickGenerator;
+
+	// True if every voxel in [min,max) is known to be empty without
+	// generating it
+	typedef std::function<bool(glm::ivec3 min, glm::ivec3 max)> BrickReject;
+
+	struct Stats{
+		int resident;    // bricks in the atlas
+		int pending;     // requested, not uploaded yet
+		int rejected;    // skipped up front by the reject test
+		int empty;       // generated, found empty : no slot needed
+		int generated;   // total bricks generated
+		int evicted;     // total bricks dropped from the atlas
+	};
+
+	// Sets up a size^3 volume of brick^3 bricks, keeping at most capacity
+	// of them resident. Must be called on the GL thread.
+	void init(int size, int brick, int capacity, BrickGenerator generate, BrickReject reject, int threads = 0);
+
+	// Stops the workers and frees the textures
+	void shutdown();
+
+	// Stops the workers only, leaving the textures alone : for the exit,
+	// when the GL context may already be gone
+	void stop();
+
+	// Forgets every brick and generates them with generate from now on ;
+	// the bricks requested before still come from the old generator, and
+	// are dropped. Must be called on the GL thread.
+	void reset(BrickGenerator generate, BrickReject reject);
+
+	// Visibility pass : requests up to maxRequests missing bricks inside
+	// the view, nearest to the eye first, and marks the visible resident
+	// ones as used. mvp maps texture coordinates to clip space, eye is
+	// in texture coordinates.
+	void update(const glm::mat4 & mvp, const glm::vec3 & eye, int maxRequests = 64);
+
+	// Uploads up to maxUploads generated bricks (all of them if negative),
+	// evicting the least recently used ones when the atlas is full.
+	// Must be called regularly on the GL thread. Returns the number of
+	// bricks uploaded.
+	int pump(int maxUploads = -1);
+
+	GLuint pageTexture();
+	GLuint atlasTexture();
+
+	// Voxels per side of the volume, bricks per side (the last ones
+	// reaching past the volume when brick does not divide size), voxels
+	// per side of a brick, and texels per side of the atlas
+	int size();
+	int pages();
+	int brickSize();
+	int atlasSize();
+
+	Stats stats();
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef VOLUMELAYOUT_HPP
+#define VOLUMELAYOUT_HPP
+
+#include <vector>
+#include <cstddef>
+
+#include "parallel.hpp"
+
+// Memory layouts of a cubic volume : where voxel (s,t,r) lives in the
+// buffer. Code templated on the layout only calls index() and size(),
+// so each layout gets its own fully inlined copy.
+
+// The order OpenGL takes : s fastest, then t, then r. Rays along r touch
+// a new cache line every step.
+struct LinearLayout{
+	int n;
+
+	LinearLayout(int n = 0) : n(n) {}
+	size_t size() const { return (size_t)n*n*n; }
+	size_t index(int s, int t, int r) const { return ((size_t)r*n + t)*n + s; }
+};
+
+// Spreads the low bits of x two bits apart : abc -> a00b00c
+template<int BITS>
+inline unsigned int mortonSpread(unsigned int x){
+	unsigned int spread = 0;
+	for (int i = 0; i < BITS; i++)
+		spread |= ((x >> i) & 1) << (3*i);
+	return spread;
+}
+
+// Morton (Z order) index of (s,t,r) within a cube of 2^BITS voxels a side
+template<int BITS>
+inline unsigned int mortonIndex(unsigned int s, unsigned int t, unsigned int r){
+	return mortonSpread<BITS>(s) | (mortonSpread<BITS>(t) << 1) | (mortonSpread<BITS>(r) << 2);
+}
+
+// Bricks of SIDE^3 voxels stored one after the other, in linear order, with
+// the voxels of a brick in Morton order : neighbours in any direction are
+// mostly within the same few cache lines. The volume is rounded up to
+// whole bricks. This pays once the volume outgrows the caches ; a volume
+// that fits in them samples faster linear, without the index arithmetic.
+template<int SIDE>
+struct BrickedLayout{
+	static_assert(SIDE == 2 || SIDE == 4 || SIDE == 8 || SIDE == 16, "bricks must be 2, 4, 8 or 16 voxels a side");
+	static const int BITS = SIDE == 2 ? 1 : SIDE == 4 ? 2 : SIDE == 8 ? 3 : 4;
+
+	int n;
+	int bricks;   // per side
+	unsigned int spread[SIDE];   // mortonSpread of every coordinate within a brick
+
+	BrickedLayout(int n = 0) : n(n), bricks((n + SIDE-1) / SIDE){
+		for (int i = 0; i < SIDE; i++)
+			spread[i] = mortonSpread<BITS>(i);
+	}
+	size_t size() const { return (size_t)bricks*bricks*bricks * SIDE*SIDE*SIDE; }
+	size_t index(int s, int t, int r) const {
+		size_t brick = ((size_t)(r >> BITS)*bricks + (t >> BITS))*bricks + (s >> BITS);
+		return (brick << (3*BITS)) | spread[s & (SIDE-1)] | (spread[t & (SIDE-1)] << 1) | (spread[r & (SIDE-1)] << 2);
+	}
+};
+
+// Copies the n*n*n volume in from one layout to another ; voxels the
+// destination has beyond n are left alone. Slabs are copied in parallel.
+template<class From, class To>
+void convertLayout(const unsigned char * in, const From & from, unsigned char * out, const To & to, int n){
+	parallel_for(0, n, [&](int first, int last){
+		for (int r = first; r < last; r++)
+		for (int t = 0; t < n; t++)
+		for (int s = 0; s < n; s++)
+			out[to.index(s, t, r)] = in[from.index(s, t, r)];
+	});
+}
+
+template<class Layout>
+void fromLinear(const unsigned char * linear, int n, const Layout & layout, std::vector<unsigned char> & out){
+	out.assign(layout.size(), 0);
+	convertLayout(linear, LinearLayout(n), &out[0], layout, n);
+}
+
+template<class Layout>
+void toLinear(const unsigned char * data, const Layout & layout, int n, std::vector<unsigned char> & out){
+	out.resize((size_t)n*n*n);
+	convertLayout(data, layout, &out[0], LinearLayout(n), n);
+}
+
+#endif
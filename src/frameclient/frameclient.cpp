@@ -0,0 +1,104 @@
+// Sample client of the raycast frame server : attaches to the frames
+// published in shared memory and reports, every second, the frame rate
+// delivered, the latency from render to delivery, the frames it missed
+// and the ones overwritten while it read them. When the server goes, or
+// starts over in a new segment, it waits for the server and attaches again.
+//
+// frameclient [seconds] [name]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <algorithm>
+
+#include "common/frameserver.hpp"
+
+// without a frame for that long, checks whether the server is still there
+#define FRAMECLIENT_QUIET_NS 200000000ull
+
+// opens name, trying again until deadline on the monotonic clock
+static bool attach(frameserver::Reader & reader, const std::string & name, uint64_t deadline)
+{
+	while (!reader.open(name)){
+		if (frameserver::monotonicNanoseconds() > deadline)
+			return false;
+		usleep(100000);
+	}
+	printf("attached to %s : %d x %d frames\n", name.c_str(), reader.width(), reader.height());
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	double duration = argc > 1 ? atof(argv[1]) : 10;
+	std::string name = argc > 2 ? argv[2] : FRAMESERVER_NAME;
+	uint64_t durationNs = (uint64_t)(duration * 1e9);
+
+	frameserver::Reader reader;
+	if (!attach(reader, name, frameserver::monotonicNanoseconds() + durationNs)){
+		printf("no frame server at %s : toggle it with 'f' in raycast\n", name.c_str());
+		return 1;
+	}
+
+	size_t frameBytes = (size_t)reader.width() * reader.height() * 4;
+	uint64_t lastSequence = 0;
+	long frames = 0, missed = 0, torn = 0, totalFrames = 0;
+	double latencySum = 0, latencyMax = 0;
+	unsigned int checksum = 0;
+	uint64_t second = frameserver::monotonicNanoseconds();
+	uint64_t start = second, quietSince = second;
+
+	while (frameserver::monotonicNanoseconds() - start < durationNs){
+		uint64_t sequence, renderedNs;
+		const unsigned char * pixels = reader.acquire(sequence, renderedNs);
+		if (!pixels){
+			uint64_t now = frameserver::monotonicNanoseconds();
+			if (now - quietSince < FRAMECLIENT_QUIET_NS){
+				usleep(500);
+			} else if (!reader.replaced()){
+				// only paused
+				quietSince = now;
+			} else {
+				printf("frame server gone from %s, waiting for it\n", name.c_str());
+				reader.close();
+				if (!attach(reader, name, start + durationNs))
+					break;
+				frameBytes = (size_t)reader.width() * reader.height() * 4;
+				lastSequence = 0;
+				quietSince = frameserver::monotonicNanoseconds();
+			}
+		} else {
+			quietSince = frameserver::monotonicNanoseconds();
+			// what a recorder would do with the frame : read all of it
+			for (size_t i = 0; i < frameBytes; i += 64)
+				checksum += pixels[i];
+			uint64_t now = frameserver::monotonicNanoseconds();
+			if (!reader.release()){
+				torn++;
+			} else {
+				double latency = (now - renderedNs) * 1e-6;
+				latencySum += latency;
+				latencyMax = std::max(latencyMax, latency);
+				frames++;
+			}
+			if (lastSequence && sequence > lastSequence + 1)
+				missed += sequence - lastSequence - 1;
+			lastSequence = sequence;
+		}
+
+		uint64_t now = frameserver::monotonicNanoseconds();
+		double elapsed = (now - second) * 1e-9;
+		if (elapsed >= 1.0){
+			printf("%.1f frames/s, latency %.2f ms mean, %.2f ms max, %ld missed, %ld torn\n",
+			       frames / elapsed, frames ? latencySum / frames : 0.0, latencyMax, missed, torn);
+			totalFrames += frames;
+			frames = 0;
+			latencySum = latencyMax = 0;
+			second = now;
+		}
+	}
+	totalFrames += frames;
+	printf("%ld frames in %.0f s, %ld missed, %ld torn (checksum %u)\n", totalFrames, duration, missed, torn, checksum);
+	return 0;
+}
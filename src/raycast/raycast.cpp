@@ -20,10 +20,33 @@
 #include <cmath>
 #include <ctime>
 #include <cassert>
+#include <future>
+#include <chrono>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include "Vector3.h"
 #include "controls.hpp"
 #include <string>
 #include "common/perlin.hpp"
+#include "common/texture.hpp"
+#include "common/texturecache.hpp"
+#include "common/mipmap.hpp"
+#include "common/occupancy.hpp"
+#include "common/gradient.hpp"
+#include "common/transferfunction.hpp"
+#include "common/distancefield.hpp"
+#include "common/marchingcubes.hpp"
+#include "common/objloader.hpp"
+#include "common/brickupdate.hpp"
+#include "common/virtualvolume.hpp"
+#include "common/brickstore.hpp"
+#include "common/framering.hpp"
+#include "common/timeseries.hpp"
+#include "common/frameserver.hpp"
+#include "common/cpuraycast.hpp"
+#include "common/sortlast.hpp"
+#include "common/parallel.hpp"
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -31,6 +54,34 @@
 
 #define WINDOW_SIZE 800
 
+// virtual volume : voxels per side, voxels per brick side, resident bricks
+#define VIRTUAL_VOLUME_SIZE 1024
+#define VIRTUAL_BRICK_SIZE  32
+#define VIRTUAL_CAPACITY    512
+
+// brick files : default host cache, in MB, and bricks read ahead per frame
+#define BRICK_CACHE_MB      256
+#define BRICK_PREFETCH      128
+
+// side of the volume --cpu-bench times the memory layouts on besides the
+// generated one : 128 MB, more than most last level caches
+#define LAYOUT_BENCH_SIZE 512
+
+// animated noise : frames generated ahead, noise time between frames
+#define ANIMATION_FRAMES 16
+#define ANIMATION_STEP   0.04f
+
+// time series playback : default frame rate, frames decoded and files
+// read ahead
+#define SERIES_FPS       24
+#define SERIES_QUEUE     4
+#define SERIES_READAHEAD 8
+
+// octaves of noise1 in volume_voxel : PerlinNoise4D(..., alpha, beta, n)
+#define NOISE1_ALPHA   5
+#define NOISE1_BETA    6
+#define NOISE1_OCTAVES 3
+
 using namespace std;
 
 // Globals ------------------------------------------------------------------
@@ -44,8 +95,30 @@ GLuint renderbuffer;
 GLuint framebuffer;
 CGprogram vertex_main,fragment_main; // the raycasting shader programs
 GLuint volume_texture; // the volume texture
+TextureData volume_pyramid; // CPU copy of the volume and its mip levels
+TextureData volume_uploaded; // what volume_texture currently holds
+GLuint volume_staging = 0; // pixel buffer for partial volume updates
+GLuint gradient_texture = 0; // precomputed gradients of the volume
+GLuint distance_texture = 0; // signed distance to the volume surface
+int    volume_width     = 0; // size of level 0 of volume_texture
+int    volume_max_level = 0; // last mip level of volume_texture
+vector<unsigned char> volume_gradients; // analytic gradients, emitted with the volume
+TransferFunction transfer_function;
+GLuint preint_texture = 0; // pre-integrated transfer function table
+GLuint animation_texture = 0; // the frame of the animated noise on screen
+int    animation_size = 0;    // side of the frames in the ring, and of animation_texture
+GLuint series_textures[2] = {0, 0}; // time series frames : one on screen, one being uploaded
+GLuint series_staging[2] = {0, 0};  // their pixel buffers
+TextureData series_layouts[2];      // levels and format of each, without pixels
+int    series_front = 0;            // the one on screen
+bool   series_pending = false;      // the other one got a frame last display
+GLuint frame_readback[2] = {0, 0};  // pixel buffers final_image is read back through
+uint64_t frame_rendered[2] = {0, 0}; // when the frame in each was rendered, 0 : none
+int    frame_readback_next = 0;     // the one the next frame goes into
 GLuint backface_buffer; // the FBO buffers
 GLuint final_image;
+glm::vec3 eye_position; // the camera, in volume coordinates
+vector<ProxyBox> proxy_boxes; // occupied part of the volume
 
 bool    animation_mode   = false;
 bool    adaptive_mode    = false;
@@ -53,11 +126,24 @@ bool    fill_mode		 = false;
 bool    xray_mode		 = false;
 bool    color_mode		 = false;
 bool    autoupdate_mode  = true;
+bool    analytic_mode    = true;   // ray exit from a ray-box test instead of the backface pass
+bool    proxy_mode       = true;   // start rays on the occupied bricks only
+bool    shading_mode     = false;  // diffuse shading from the gradient volume
+bool    preint_mode      = false;  // pre-integrated transfer function
+bool    sdf_mode         = false;  // sphere trace empty space with the distance field
+bool    lod_mode         = true;   // coarser volume levels for distant samples
+bool    virtual_mode     = false;  // bricks of a large volume generated on demand
+bool    noise_animation_mode = false; // the noise evolving in time, frames generated ahead
+bool    series_mode      = false;  // playing the time series given on the command line
+bool    frameserver_mode = false;  // publishing every frame in shared memory
+int     tf_threshold     = 0;      // densities below are transparent
 float 	stepsize 		 = 1.0/50.0;
 float 	volume_radius 	 = 0.12f;
 int 	volume_tex_size  = 64;
 bool 	verbose 		 = false;
 int 	noise_powerindex = 4;
+string  volume_path;      // precomputed .dds volume given on the command line
+TextureHandle volume_file; // keeps the loaded volume alive
 
 /// Implementation ----------------------------------------
 
@@ -83,10 +169,24 @@ void set_tex_param(string par, GLuint tex,const CGprogram &program,CGparameter p
 }
 
 
-void load_vertex_program(CGprogram &v_program, string shader_path, string program_name)
+// reads a whole shader file ; touches neither Cg nor OpenGL, so it can
+// run on a worker thread
+string read_shader_source(string shader_path)
+{
+	ifstream file(shader_path.c_str(), ios::in | ios::binary);
+	if (!file){
+		cout << shader_path << " could not be opened" << endl;
+		exit(1);
+	}
+	stringstream source;
+	source << file.rdbuf();
+	return source.str();
+}
+
+void load_vertex_program(CGprogram &v_program, const string &shader_source, string program_name)
 {
 	assert(cgIsContext(context));
-	v_program = cgCreateProgramFromFile(context, CG_SOURCE,shader_path.c_str(),
+	v_program = cgCreateProgram(context, CG_SOURCE,shader_source.c_str(),
 		vertexProfile,program_name.c_str(), NULL);
 	if (!cgIsProgramCompiled(v_program))
 		cgCompileProgram(v_program);
@@ -96,10 +196,10 @@ void load_vertex_program(CGprogram &v_program, string shader_path, string progra
 	cgGLDisableProfile(vertexProfile);
 }
 
-void load_fragment_program(CGprogram &f_program,string shader_path, string program_name)
+void load_fragment_program(CGprogram &f_program, const string &shader_source, string program_name)
 {
 	assert(cgIsContext(context));
-	f_program = cgCreateProgramFromFile(context, CG_SOURCE, shader_path.c_str(),
+	f_program = cgCreateProgram(context, CG_SOURCE, shader_source.c_str(),
 		fragmentProfile,program_name.c_str(), NULL);
 	if (!cgIsProgramCompiled(f_program))
 		cgCompileProgram(f_program);
@@ -127,59 +227,74 @@ void vertex(float x, float y, float z)
 	glVertex3f(x,y,z);
 }
 
-// draw the front and backside of the volume
-void drawQuads(float x, float y, float z)
+// draw the front and backside of the box [x0,x1]*[y0,y1]*[z0,z1]
+void drawBox(float x0, float y0, float z0, float x, float y, float z)
 {
 
 	glBegin(GL_QUADS);
 	/* Back side */
 	glNormal3f(0.0, 0.0, -1.0);
-	vertex(0.0, 0.0, 0.0);
-	vertex(0.0, y, 0.0);
-	vertex(x, y, 0.0);
-	vertex(x, 0.0, 0.0);
+	vertex(x0, y0, z0);
+	vertex(x0, y, z0);
+	vertex(x, y, z0);
+	vertex(x, y0, z0);
 
 	/* Front side */
 	glNormal3f(0.0, 0.0, 1.0);
-	vertex(0.0, 0.0, z);
-	vertex(x, 0.0, z);
+	vertex(x0, y0, z);
+	vertex(x, y0, z);
 	vertex(x, y, z);
-	vertex(0.0, y, z);
+	vertex(x0, y, z);
 
 	/* Top side */
 	glNormal3f(0.0, 1.0, 0.0);
-	vertex(0.0, y, 0.0);
-	vertex(0.0, y, z);
+	vertex(x0, y, z0);
+	vertex(x0, y, z);
     vertex(x, y, z);
-	vertex(x, y, 0.0);
+	vertex(x, y, z0);
 
 	/* Bottom side */
 	glNormal3f(0.0, -1.0, 0.0);
-	vertex(0.0, 0.0, 0.0);
-	vertex(x, 0.0, 0.0);
-	vertex(x, 0.0, z);
-	vertex(0.0, 0.0, z);
+	vertex(x0, y0, z0);
+	vertex(x, y0, z0);
+	vertex(x, y0, z);
+	vertex(x0, y0, z);
 
 	/* Left side */
 	glNormal3f(-1.0, 0.0, 0.0);
-	vertex(0.0, 0.0, 0.0);
-	vertex(0.0, 0.0, z);
-	vertex(0.0, y, z);
-	vertex(0.0, y, 0.0);
+	vertex(x0, y0, z0);
+	vertex(x0, y0, z);
+	vertex(x0, y, z);
+	vertex(x0, y, z0);
 
 	/* Right side */
 	glNormal3f(1.0, 0.0, 0.0);
-	vertex(x, 0.0, 0.0);
-	vertex(x, y, 0.0);
+	vertex(x, y0, z0);
+	vertex(x, y, z0);
 	vertex(x, y, z);
-	vertex(x, 0.0, z);
+	vertex(x, y0, z);
 	glEnd();
 
 }
 
+// draw the front and backside of the volume
+void drawQuads(float x, float y, float z)
+{
+	drawBox(0.0, 0.0, 0.0, x, y, z);
+}
+
+// draw the occupied part of the volume only ; with the depth test on,
+// every ray starts at the first occupied boundary it meets
+void drawProxy()
+{
+	for (auto & box : proxy_boxes)
+		drawBox(box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z);
+}
+
 
 
-float gw4DNoise(float x, float y, float z,
+// w is the time ; it runs faster in the finer octaves, as space does
+float gw4DNoise(float x, float y, float z, float w,
 				float frequency, float offset, float freqMult, float roughness, float octaves)
 {
 	int i;
@@ -188,19 +303,20 @@ float gw4DNoise(float x, float y, float z,
 
 	for (i = 0; (float)i < octaves; i++){
 		if (i==0){
-			value += noise::PerlinNoise3D(x*frequency+offset, y*frequency+offset, z*frequency+offset, 5,6,3)-0.5;
+			value += noise::PerlinNoise4D(x*frequency+offset, y*frequency+offset, z*frequency+offset, w, 5,6,3)-0.5;
 		} else {
-			value += (noise::PerlinNoise3D(x*frequency+offset, y*frequency+offset, z*frequency+offset, 5,6,3)-0.5 ) * pow(roughness, (float)i);
+			value += (noise::PerlinNoise4D(x*frequency+offset, y*frequency+offset, z*frequency+offset, w, 5,6,3)-0.5 ) * pow(roughness, (float)i);
 		}
 		frequency = frequency * freqMult;
 		offset = offset * freqMult;
+		w = w * freqMult;
 		}
 
 	remainder = octaves - floor(octaves);
 
 	if (octaves > 0)
 		{
-		value += remainder * (noise::PerlinNoise3D(x*frequency+offset, y*frequency+offset, z*frequency+offset, 5,6,3)-0.5 ) * pow(roughness, (float)i);
+		value += remainder * (noise::PerlinNoise4D(x*frequency+offset, y*frequency+offset, z*frequency+offset, w, 5,6,3)-0.5 ) * pow(roughness, (float)i);
 
 		}
 
@@ -208,62 +324,556 @@ float gw4DNoise(float x, float y, float z,
 
 }
 
-void create_volumetexture(bool randomize=false)
+// precomputes the gradients of the current volume for shading ; only
+// done while shading is on
+void upload_gradienttexture()
+{
+	if (!shading_mode || volume_pyramid.levels.empty()) return;
+
+	const TextureLevel & top = volume_pyramid.levels[0];
+	int n = top.width;
+	vector<unsigned char> gradients;
+	if (volume_gradients.size() == (size_t)n*n*n*4)
+		gradients = volume_gradients;
+	else
+		buildGradientVolume(&volume_pyramid.storage[top.offset], n, gradients);
+
+	if (!gradient_texture)
+		glGenTextures(1, &gradient_texture);
+	glBindTexture(GL_TEXTURE_3D, gradient_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8, n, n, n, 0, GL_RGBA, GL_UNSIGNED_BYTE, &gradients[0]);
+}
+
+// builds the distance field of the current volume for empty space
+// skipping ; only done while sphere tracing is on
+void upload_distancetexture()
+{
+	if (!sdf_mode || volume_pyramid.levels.empty()) return;
+
+	const TextureLevel & top = volume_pyramid.levels[0];
+	int n = top.width;
+	vector<unsigned char> field;
+	buildDistanceField(&volume_pyramid.storage[top.offset], n, 0, field);
+
+	if (!distance_texture)
+		glGenTextures(1, &distance_texture);
+	glBindTexture(GL_TEXTURE_3D, distance_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_LUMINANCE8, n, n, n, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, &field[0]);
+}
+
+// uploads the pre-integrated transfer function table
+void upload_preintegration()
+{
+	if (!preint_texture){
+		glGenTextures(1, &preint_texture);
+		glBindTexture(GL_TEXTURE_2D, preint_texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_2D, preint_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, TF_SIZE, TF_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, &transfer_function.table[0]);
+}
+
+// moves the transfer function threshold ; only the affected part of
+// the table is integrated again
+void set_tf_threshold(int threshold)
+{
+	threshold = max(0, min(threshold, TF_SIZE));
+	setTransferFunctionThreshold(transfer_function, tf_threshold, threshold);
+	tf_threshold = threshold;
+	upload_preintegration();
+}
+
+// the ray loop picks volume levels itself ; the mip levels are only
+// reachable with a mipmapped minification filter
+void set_volume_filter()
+{
+	if (!volume_texture) return;
+	glBindTexture(GL_TEXTURE_3D, volume_texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, (lod_mode && volume_max_level > 0) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+}
+
+// uploads volume_pyramid into volume_texture ; if only the contents
+// changed, only the bricks that differ are sent
+void upload_volumetexture()
+{
+	if (volume_file){
+		volume_file.reset();
+		volume_texture = 0;
+	}
+
+	bool updated = false;
+	if (volume_texture && sameTextureLayout(volume_uploaded, volume_pyramid)){
+		vector<TextureBrick> bricks;
+		diffTextureBricks(volume_uploaded, volume_pyramid, 16, bricks);
+		size_t bytes;
+		updated = uploadTextureBricks(volume_texture, volume_pyramid, bricks, volume_staging, bytes);
+		if (updated)
+			cout << "volume texture updated : " << bricks.size() << " bricks, " << bytes << " of " << volume_pyramid.storage.size() << " bytes" << endl;
+		else
+			cout << "volume texture update failed, uploading it whole" << endl;
+	}
+	// volume_uploaded only follows what did reach the texture, or the
+	// next diff would skip the bricks that were lost
+	if (!updated){
+		if (volume_texture)
+			glDeleteTextures(1, &volume_texture);
+		volume_texture = uploadTexture(volume_pyramid);
+	}
+	volume_uploaded = volume_pyramid;
+
+	const TextureLevel & top = volume_pyramid.levels[0];
+	volume_width     = top.width;
+	volume_max_level = (int)volume_pyramid.levels.size() - 1;
+	set_volume_filter();
+	buildProxyBoxes(&volume_pyramid.storage[top.offset], top.width, 8, proxy_boxes);
+	upload_gradienttexture();
+	upload_distancetexture();
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+}
+
+// derives the next smaller volume from the mip pyramid instead of
+// generating it again ; returns false if the pyramid can not provide it
+bool shrink_volumetexture()
+{
+	if (volume_pyramid.levels.size() < 2 || (int)volume_pyramid.levels[1].width != volume_tex_size)
+		return false;
+
+	size_t dropped = volume_pyramid.levels[0].size;
+	volume_pyramid.storage.erase(volume_pyramid.storage.begin(), volume_pyramid.storage.begin() + dropped);
+	volume_pyramid.levels.erase(volume_pyramid.levels.begin());
+	for (auto & level : volume_pyramid.levels)
+		level.offset -= dropped;
+
+	upload_volumetexture();
+	cout << "volume texture derived from the mip pyramid" << endl;
+	return true;
+}
+
+// keeps the current volume and its mip levels next to the executable
+void save_volumetexture()
+{
+	if (volume_pyramid.levels.empty()){
+		cout << "no generated volume to save" << endl;
+		return;
+	}
+	if (saveDDS("volume.dds", volume_pyramid))
+		cout << "volume saved to volume.dds" << endl;
+}
+
+// extracts the surface of the current volume as a mesh and writes it
+// next to the executable
+void save_isosurface()
+{
+	if (volume_pyramid.levels.empty()){
+		cout << "no generated volume to extract a surface from" << endl;
+		return;
+	}
+	const TextureLevel & top = volume_pyramid.levels[0];
+	vector<unsigned int> indices;
+	vector<glm::vec3> vertices, normals;
+	vector<glm::vec2> uvs;
+	extractIsosurface(&volume_pyramid.storage[top.offset], top.width, 0.5f, indices, vertices, uvs, normals);
+	if (saveOBJ("volume.obj", indices, vertices, uvs, normals))
+		cout << "surface saved to volume.obj (" << indices.size()/3 << " triangles)" << endl;
+}
+
+// same as gw4DNoise, and also writes the analytic gradient with respect
+// to x, y and z to grad
+float gw4DNoise_deriv(float x, float y, float z, float w,
+				float frequency, float offset, float freqMult, float roughness, float octaves, float grad[3])
+{
+	int i;
+	float value = 0;
+	float remainder;
+	float weight;
+	double g[3];
+
+	grad[0] = grad[1] = grad[2] = 0;
+	for (i = 0; (float)i < octaves; i++){
+		weight = (i==0) ? 1 : pow(roughness, (float)i);
+		value += (noise::PerlinNoise4D_deriv(x*frequency+offset, y*frequency+offset, z*frequency+offset, w, 5,6,3,g)-0.5) * weight;
+		for (int k = 0; k < 3; k++)
+			grad[k] += g[k] * frequency * weight;
+		frequency = frequency * freqMult;
+		offset = offset * freqMult;
+		w = w * freqMult;
+		}
+
+	remainder = octaves - floor(octaves);
+
+	if (octaves > 0)
+		{
+		weight = remainder * pow(roughness, (float)i);
+		value += (noise::PerlinNoise4D_deriv(x*frequency+offset, y*frequency+offset, z*frequency+offset, w, 5,6,3,g)-0.5 ) * weight;
+		for (int k = 0; k < 3; k++)
+			grad[k] += g[k] * frequency * weight;
+		}
+
+	return value;
+
+}
+
+// parameters of the noise volume ; 'r' draws new ones
+float noise_rnd = 0.219619;
+int   noise_offset1 = 19;
+int   noise_offset2 = 46;
+int   noise_offset3 = 49;
+
+// a copy of the parameters above, volume_radius and noise_powerindex, for
+// the threads generating the noise while the keys change the originals
+struct NoiseParams{
+	float radius;
+	float rnd;
+	int   powerindex;
+	int   offset1, offset2, offset3;
+};
+
+NoiseParams noise_params()
+{
+	NoiseParams params = {volume_radius, noise_rnd, noise_powerindex, noise_offset1, noise_offset2, noise_offset3};
+	return params;
+}
+
+// bound on |noise1| in volume_voxel : a noise3 octave stays within
+// sqrt(3)/2, the reach of unit gradients over half the cell diagonal,
+// noise4 blends two of them, and the octaves are weighted 1/alpha^i
+float noise1_bound()
+{
+	float bound = 0, weight = 1;
+	for (int i = 0; i < NOISE1_OCTAVES; i++, weight /= NOISE1_ALPHA)
+		bound += weight;
+	return sqrtf(3.0f) / 2 * bound;
+}
+
+// density of voxel (x,y,z) of an n*n*n noise volume at noise time time ;
+// with grad, also its analytic gradient along x, y and z
+unsigned char volume_voxel(const NoiseParams & params, int x, int y, int z, int n, float * grad=NULL, float time=0)
+{
+	bool analytic = grad != NULL;
+	float r = params.radius;
+	float frequency = 3.0f / n;
+	float center = n / 2.0f + 0.5f;
+
+	float dx = center-x;
+	float dy = center-y;
+	float dz = center-z;
+
+	float goff[3];
+	double goff1[3];
+	float off = analytic ? gw4DNoise_deriv(x,y,z,time, frequency, 0 ,1.1+params.rnd, 1.1+params.rnd, params.powerindex, goff)
+	                     : gw4DNoise(x,y,z,time, frequency, 0 ,1.1+params.rnd, 1.1+params.rnd, params.powerindex);
+	float off_sign = off < 0 ? -1 : 1;
+	off = abs(off);
+	//off = 1-pow(off/2,2);
+	//cout<<off<<endl;
+	float noise1 = analytic ? (float) noise::PerlinNoise4D_deriv(
+		x*frequency+params.offset1,
+		y*frequency+params.offset2,
+		z*frequency+params.offset3,
+		time,
+		NOISE1_ALPHA,
+		NOISE1_BETA, NOISE1_OCTAVES, goff1)
+	                        : (float) noise::PerlinNoise4D(
+		x*frequency+params.offset1,
+		y*frequency+params.offset2,
+		z*frequency+params.offset3,
+		time,
+		NOISE1_ALPHA,
+		NOISE1_BETA, NOISE1_OCTAVES);
+	float off1 = fabsf(noise1);
+	float noise0 = off;
+	off *= off1;
+	float product = off;
+	off = pow(off, 0.1);
+	float d = sqrtf(dx*dx+dy*dy+dz*dz)/(n);
+	//cout << d <<endl;
+	bool isFilled = (d-off1) < r;
+	unsigned char density = isFilled ? off*255 : 0;
+	//*ptr++ = (int)(off*255);
+
+	if(analytic){
+		// chain rule through off1 = |noise1| and
+		// 255 * (|noise0| * off1)^0.1, per voxel
+		float noise1_sign = noise1 < 0 ? -1 : 1;
+		float g[3], goff1v[3], gd[3];
+		float step = product > 0 ? 255 * 0.1f * pow(product, -0.9f) : 0;
+		float dist = sqrtf(dx*dx+dy*dy+dz*dz);
+		float delta[3] = {dx, dy, dz};
+		for (int k = 0; k < 3; k++){
+			goff1v[k] = noise1_sign * goff1[k] * frequency;
+			g[k] = step * (off_sign * goff[k] * off1 + noise0 * goff1v[k]);
+			gd[k] = dist > 0 ? -delta[k] / (n * dist) : 0;
+		}
+		float boundary = (d-off1) - r;
+		if (!isFilled){
+			g[0] = g[1] = g[2] = 0;
+		} else if (boundary > -1.0f/n){
+			// next to the surface (d - off1 = r) the density
+			// drops to zero : the surface normal dominates
+			float normal[3] = {gd[0]-goff1v[0], gd[1]-goff1v[1], gd[2]-goff1v[2]};
+			float length = sqrtf(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+			for (int k = 0; k < 3 && length > 0; k++)
+				g[k] = -normal[k] / length * off * 255;
+		}
+		for (int k = 0; k < 3; k++)
+			grad[k] = g[k];
+	}
+	return density;
+}
+
+// bricks of the virtual volume and their apron, straight from the noise
+// of params
+virtualvolume::BrickGenerator virtual_brick_generator(NoiseParams params)
+{
+	return [params](int x, int y, int z, int size, unsigned char * out){
+		int apron = size + 2;
+		for (int i = 0; i < apron; i++)
+		for (int j = 0; j < apron; j++)
+		for (int k = 0; k < apron; k++)
+			*out++ = volume_voxel(params, x+i, y+j, z+k, VIRTUAL_VOLUME_SIZE);
+	};
+}
+
+// true if the whole brick lies further than the radius + noise1_bound()
+// from the center, where volume_voxel is always empty. As noise1_bound()
+// alone is past the half diagonal of the volume, sqrt(3)/2, this never
+// happens with the current octaves ; the noise itself stays within about
+// 0.68, but that is measured, not a bound.
+virtualvolume::BrickReject virtual_brick_rejecter(NoiseParams params)
+{
+	float reach = params.radius + noise1_bound();
+	return [reach](glm::ivec3 min, glm::ivec3 max){
+		float n = VIRTUAL_VOLUME_SIZE;
+		glm::vec3 center(n / 2.0f + 0.5f);
+		glm::vec3 nearest = glm::clamp(center, glm::vec3(min), glm::vec3(max - 1));
+		return glm::length(nearest - center) / n >= reach;
+	};
+}
+
+// the virtual volume pages in the open brick file, or the noise
+void toggle_virtualvolume()
+{
+	virtual_mode = !virtual_mode;
+	if (virtual_mode && brickstore::isOpen())
+		virtualvolume::init(brickstore::size(), brickstore::brickSize(), VIRTUAL_CAPACITY, brickstore::read, brickstore::empty);
+	else if (virtual_mode)
+		virtualvolume::init(VIRTUAL_VOLUME_SIZE, VIRTUAL_BRICK_SIZE, VIRTUAL_CAPACITY,
+		                    virtual_brick_generator(noise_params()), virtual_brick_rejecter(noise_params()));
+	else
+		virtualvolume::shutdown();
+}
+
+// starts generating frames of the noise, from time 0 on, into the ring ;
+// display() shows them as they come
+void start_noise_animation()
+{
+	int n = animation_size = volume_tex_size;
+	if (!animation_texture)
+		glGenTextures(1, &animation_texture);
+	glBindTexture(GL_TEXTURE_3D, animation_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	// as volume_texture : empty beyond the faces
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_LUMINANCE, n, n, n, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+
+	NoiseParams params = noise_params();
+	framering::init((size_t)n*n*n, ANIMATION_FRAMES, [n, params](int frame, unsigned char * out){
+		float time = frame * ANIMATION_STEP;
+		for (int x = 0; x < n; x++)
+		for (int y = 0; y < n; y++)
+		for (int z = 0; z < n; z++)
+			*out++ = volume_voxel(params, x, y, z, n, NULL, time);
+	});
+}
+
+void toggle_noise_animation()
+{
+	noise_animation_mode = !noise_animation_mode;
+	if (noise_animation_mode)
+		start_noise_animation();
+	else
+		framering::shutdown();
+}
+
+// puts the next frame of the animation in animation_texture, if it is
+// ready ; never waits for it
+void show_animation_frame()
+{
+	// the size changed without a new volume ('-' shrinks the one there,
+	// and nothing is generated with autoupdate off) : the frames follow
+	if (animation_size != volume_tex_size)
+		start_noise_animation();
+
+	int frame;
+	const unsigned char * voxels = framering::acquire(frame);
+	if (!voxels) return;
+	int n = animation_size;
+	glBindTexture(GL_TEXTURE_3D, animation_texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, n, n, n, GL_LUMINANCE, GL_UNSIGNED_BYTE, voxels);
+	framering::release();
+}
+
+void toggle_series()
+{
+	if (!timeseries::isOpen()){
+		cout << "no time series : start with --series directory" << endl;
+		return;
+	}
+	series_mode = !series_mode;
+	// plays on from the last frame shown, not from where the clock got to
+	if (series_mode)
+		timeseries::setFrameRate(timeseries::stats().targetFps);
+}
+
+// takes the frame due from the time series and uploads it into the
+// texture not on screen ; it is shown from the next display on, so the
+// transfer overlaps drawing the previous frame
+void show_series_frame()
+{
+	if (series_pending){
+		series_front = 1 - series_front;
+		series_pending = false;
+	}
+
+	timeseries::Frame frame;
+	if (!timeseries::next(frame)) return;
+	int back = 1 - series_front;
+	size_t bytes;
+	// a buffer that cannot be mapped leaves the texture as it was : the
+	// frame goes through a new texture instead, or the swap would show
+	// the old frame again
+	bool updated = series_textures[back] && sameTextureLayout(series_layouts[back], frame.data)
+	            && uploadTextureLevels(series_textures[back], frame.data, series_staging[back], bytes);
+	if (!updated){
+		if (series_textures[back])
+			glDeleteTextures(1, &series_textures[back]);
+		series_textures[back] = uploadTexture(frame.data);
+		TextureData & layout = series_layouts[back];
+		layout.target = frame.data.target;
+		layout.format = frame.data.format;
+		layout.internalFormat = frame.data.internalFormat;
+		layout.levels = frame.data.levels;
+	}
+	freeTextureData(frame.data);
+	series_pending = true;
+}
+
+void toggle_frameserver()
+{
+	frameserver_mode = !frameserver_mode;
+	frame_rendered[0] = frame_rendered[1] = 0;
+	if (frameserver_mode && !frameserver::open(FRAMESERVER_NAME, WINDOW_SIZE, WINDOW_SIZE)){
+		cout << "could not create the shared memory " << FRAMESERVER_NAME << endl;
+		frameserver_mode = false;
+	} else if (!frameserver_mode) {
+		frameserver::close();
+	}
+}
+
+// publishes final_image to the frame server. This frame is read back into
+// one pixel buffer while the previous one, read back the display before,
+// is copied out of the other : the render loop does not wait for the
+// transfer, and the frames go out one display late.
+void publish_frame()
+{
+	size_t size = WINDOW_SIZE*WINDOW_SIZE*4;
+	if (!frame_readback[0]){
+		glGenBuffers(2, frame_readback);
+		for (int i = 0; i < 2; i++){
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, frame_readback[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		}
+	}
+
+	int current = frame_readback_next, previous = 1 - current;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, frame_readback[current]);
+	glBindTexture(GL_TEXTURE_2D, final_image);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	frame_rendered[current] = frameserver::monotonicNanoseconds();
+
+	if (frame_rendered[previous]){
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, frame_readback[previous]);
+		const unsigned char * pixels = (const unsigned char *)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		if (pixels){
+			memcpy(frameserver::frame(), pixels, size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			frameserver::publish(frame_rendered[previous]);
+		}
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	frame_readback_next = previous;
+}
+
+// fills volume_pyramid with a new noise volume and its mip levels ;
+// CPU only, so it can run while the GL thread does something else
+void generate_volume(bool randomize=false)
 {
 	cout << "generating volume texture"<<endl;
 
 	auto n = volume_tex_size;
 
-	float r =volume_radius;
-
 	//GLubyte *ptr = data;
 
-	static float rnd = 0.219619;
-	static int offset1 = 19;
-	static int offset2 = 46;
-	static int offset3 = 49;
-
 	if (randomize){
 		srand ( time(NULL) );
-		rnd = (((float)rand())/RAND_MAX)/3;
-		offset1 = rand()%50;
-		offset2 = rand()%50;
-		offset3 = rand()%50;
+		noise_rnd = (((float)rand())/RAND_MAX)/3;
+		noise_offset1 = rand()%50;
+		noise_offset2 = rand()%50;
+		noise_offset3 = rand()%50;
 	}
+	NoiseParams params = noise_params();
 
-	unsigned char *data = new unsigned char[n*n*n];
-	unsigned char *ptr = data;
-	float frequency = 3.0f / n;
-	float center = n / 2.0f + 0.5f;
+	volume_pyramid = TextureData();
+	volume_pyramid.target         = GL_TEXTURE_3D;
+	volume_pyramid.internalFormat = GL_LUMINANCE;
+	volume_pyramid.format         = GL_LUMINANCE;
+	volume_pyramid.storage.resize(n*n*n);
+	TextureLevel level = {(unsigned int)n, (unsigned int)n, (unsigned int)n, 0, (size_t)n*n*n};
+	volume_pyramid.levels.push_back(level);
+
+	unsigned char *ptr = &volume_pyramid.storage[0];
 
 	int progress = 0;
 	int lastpercent = -1;
 	int total = n*n*n;
 
+	// with shading on, the gradients come out of the noise functions
+	// along with the density, instead of from finite differences later
+	bool analytic = shading_mode;
+	volume_gradients.assign(analytic ? n*n*n*4 : 0, 0);
+	unsigned char *gptr = analytic ? &volume_gradients[0] : NULL;
+
 	for(int x=0; x < n; ++x) {
 		for (int y=0; y < n; ++y) {
 			for (int z=0; z < n; ++z) {
-				float dx = center-x;
-				float dy = center-y;
-				float dz = center-z;
-
-				float off = gw4DNoise(x,y,z, frequency, 0 ,1.1+rnd, 1.1+rnd, noise_powerindex);
-				off = abs(off);
-				//off = 1-pow(off/2,2);
-				//cout<<off<<endl;
-				float off1 = fabsf((float) noise::PerlinNoise3D(
-					x*frequency+offset1,
-					y*frequency+offset2,
-					z*frequency+offset3,
-					5,
-					6, 3));
-				off *= off1;
-				off = pow(off, 0.1);
-				float d = sqrtf(dx*dx+dy*dy+dz*dz)/(n);
-				//cout << d <<endl;
-				bool isFilled = (d-off1) < r;
-				*ptr++ = isFilled ? off*255 : 0;
-				//*ptr++ = (int)(off*255);
+				float grad[3];
+				*ptr++ = volume_voxel(params, x, y, z, n, analytic ? grad : NULL);
+				if(analytic){
+					// texture coordinates (s,t,r) run along (z,y,x)
+					packGradient(grad[2], grad[1], grad[0], gptr);
+					gptr += 4;
+				}
 
 				if(verbose){
 					progress += 1;
@@ -277,29 +887,46 @@ void create_volumetexture(bool randomize=false)
 		}
 	}
 
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
-	glGenTextures(1, &volume_texture);
-	glBindTexture(GL_TEXTURE_3D, volume_texture);
-	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
-	//glTexImage3D(GL_TEXTURE_3D, 0,GL_RGBA, VOLUME_TEX_SIZE, VOLUME_TEX_SIZE,VOLUME_TEX_SIZE,0, GL_RGBA, GL_UNSIGNED_BYTE,data);
-	glTexImage3D(GL_TEXTURE_3D, 0,
-			     GL_LUMINANCE,
-			     n, n, n, 0,
-			     GL_LUMINANCE,
-			     GL_UNSIGNED_BYTE,
-			     data);
-
-	delete []data;
-	cout << "volume texture generated" << endl;
+	buildMipmaps(volume_pyramid);
+}
 
+void create_volumetexture(bool randomize=false)
+{
+	generate_volume(randomize);
+	upload_volumetexture();
+	if (!brickstore::isOpen())
+		virtualvolume::reset(virtual_brick_generator(noise_params()), virtual_brick_rejecter(noise_params()));
+	// the frames ahead were made with the old parameters
+	if (noise_animation_mode)
+		start_noise_animation();
+	cout << "volume texture generated" << endl;
 }
 
 
+// loads a precomputed DDS volume instead of generating one
+// waits for the volume requested from the texture cache in init()
+void load_volumetexture(string path)
+{
+	cout << "loading volume texture " << path << endl;
+	volume_file = texturecache::loadNow(path);
+	if (volume_file->ready() && volume_file->texture->target == GL_TEXTURE_3D){
+		volume_texture = volume_file->id();
+		glBindTexture(GL_TEXTURE_3D, volume_texture);
+		glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_WIDTH, &volume_width);
+		glGetTexParameteriv(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, &volume_max_level);
+		set_volume_filter();
+		// no CPU copy to find the occupied bricks in
+		proxy_boxes.clear();
+		ProxyBox all = {glm::vec3(0.0f), glm::vec3(1.0f)};
+		proxy_boxes.push_back(all);
+		cout << "volume texture loaded" << endl;
+	} else {
+		volume_file.reset();
+		cout << path << " is not a volume texture" << endl;
+		create_volumetexture();
+	}
+}
+
 void update_volumetexture(bool force=false){
 	if (force || autoupdate_mode){
 		create_volumetexture();
@@ -329,7 +956,16 @@ void init()
 
 	glEnable(GL_CULL_FACE);
 	glClearColor(0.0, 0.0, 0.0, 0);
-	create_volumetexture();
+
+	// start the CPU only work : the volume (generated, or decoded by the
+	// texture cache workers) and the shader source. The GL thread sets up
+	// Cg and the framebuffers meanwhile, and the uploads happen at the end.
+	future<void> volume_task;
+	if (!volume_path.empty())
+		texturecache::load(volume_path);
+	else
+		volume_task = async(launch::async, [](){ generate_volume(); });
+	future<string> shader_task = async(launch::async, [](){ return read_shader_source("shader.cg"); });
 
 	cout << "initializing Cg" << endl;
 	cgSetErrorCallback(cgErrorCallback);
@@ -358,12 +994,14 @@ void init()
 		}
 	}
 
+	string shader_source = shader_task.get();
+
 	cout << "loading vertex shader"<<endl;
-	load_vertex_program(vertex_main,"shader.cg","vertex_main");
+	load_vertex_program(vertex_main,shader_source,"vertex_main");
 	cgErrorCallback();
 
 	cout << "loading fragment shader"<<endl;
-	load_fragment_program(fragment_main,"shader.cg","fragment_main");
+	load_fragment_program(fragment_main,shader_source,"fragment_main");
 	cgErrorCallback();
 
 	cout << "creating 'backside' and 'volume' framebuffers" << endl;
@@ -394,13 +1032,28 @@ void init()
 	glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT, WINDOW_SIZE, WINDOW_SIZE);
 	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, renderbuffer);
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	
+
+	initTransferFunction(transfer_function, stepsize, tf_threshold);
+	upload_preintegration();
+
+	// join the CPU side work and upload its results
+	if (!volume_path.empty()){
+		load_volumetexture(volume_path);
+	} else {
+		volume_task.get();
+		upload_volumetexture();
+		cout << "volume texture generated" << endl;
+	}
+	texturecache::finish();
 }
 
 // glut idle function
 void idle_func()
 {
 	controls::idle();
+	texturecache::pump(1);
+	if (virtual_mode)
+		virtualvolume::pump(8);
 	glutPostRedisplay();
 }
 
@@ -486,12 +1139,44 @@ void raycasting_pass()
 	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "fill_mode") , fill_mode);
 	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "xray_mode") , xray_mode);
 	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "color_mode") , color_mode);
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "analytic_mode") , analytic_mode);
+	// the gradients, distances and levels are those of the still volume
+	bool still = !virtual_mode && !noise_animation_mode && !series_mode;
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "shading_mode") , shading_mode && gradient_texture && still);
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "preint_mode") , preint_mode);
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "preint_step") , transfer_function.step);
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "preint_size") , TF_SIZE);
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "sdf_mode") , sdf_mode && distance_texture && still);
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "volume_size") , volume_width);
+	// a level per doubling of the voxels under one pixel, a unit away
+	// from the eye ; 60 degrees vertical field of view
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "lod_scale") , (lod_mode && still) ? volume_width * 2 * tan(M_PI/6) / WINDOW_SIZE : 0);
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "virtual_mode") , virtual_mode);
+	cgGLSetParameter3f( cgGetNamedParameter( fragment_main, "virtual_size") , (float)virtualvolume::size() / virtualvolume::brickSize(), virtualvolume::brickSize(), virtualvolume::atlasSize());
+	cgGLSetParameter1f( cgGetNamedParameter( fragment_main, "lod_max") , volume_max_level);
+	cgGLSetParameter3f( cgGetNamedParameter( fragment_main, "eye_pos") , eye_position.x, eye_position.y, eye_position.z);
 	set_tex_param("tex",backface_buffer,fragment_main,param1);
-	set_tex_param("volume_tex",volume_texture,fragment_main,param2);
+	GLuint volume = volume_texture;
+	if (series_mode && series_textures[series_front])
+		volume = series_textures[series_front];
+	else if (noise_animation_mode)
+		volume = animation_texture;
+	set_tex_param("volume_tex",volume,fragment_main,param2);
+	set_tex_param("gradient_tex",gradient_texture,fragment_main,param2);
+	set_tex_param("preint_tex",preint_texture,fragment_main,param2);
+	set_tex_param("distance_tex",distance_texture,fragment_main,param2);
+	set_tex_param("page_tex",virtualvolume::pageTexture(),fragment_main,param2);
+	set_tex_param("atlas_tex",virtualvolume::atlasTexture(),fragment_main,param2);
 
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
-	drawQuads(1.0,1.0, 1.0);
+	if(proxy_mode && !fill_mode && still){
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_LESS);
+		drawProxy();
+	} else {
+		drawQuads(1.0,1.0, 1.0);
+	}
 	glDisable(GL_CULL_FACE);
 	cgGLDisableProfile(vertexProfile);
 	cgGLDisableProfile(fragmentProfile);
@@ -531,9 +1216,33 @@ void display()
 	glRotatef(rot_h,0,1,0);
 	glRotatef(rot_v, cos(rot_h * M_PI/180), 0, sin(rot_h*M_PI/180));
 	glTranslatef(-0.5,-0.5,-0.5);
-	render_backface();
+
+	// the eye is the origin of eye space : bring it back to volume space
+	GLfloat modelview[16];
+	glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+	eye_position = glm::vec3(glm::inverse(glm::make_mat4(modelview)) * glm::vec4(0,0,0,1));
+
+	if(virtual_mode){
+		// request the bricks in view
+		GLfloat projection[16];
+		glGetFloatv(GL_PROJECTION_MATRIX, projection);
+		glm::mat4 mvp = glm::make_mat4(projection) * glm::make_mat4(modelview);
+		virtualvolume::update(mvp, eye_position);
+		// and read ahead the ones around it from the brick file
+		brickstore::prefetch(mvp, eye_position, BRICK_PREFETCH);
+	}
+
+	if(noise_animation_mode)
+		show_animation_frame();
+	if(series_mode)
+		show_series_frame();
+
+	if(!analytic_mode)
+		render_backface();
 	raycasting_pass();
 	disable_renderbuffers();
+	if(frameserver_mode)
+		publish_frame();
 	render_buffer_to_screen();
 	glutSwapBuffers();
 }
@@ -550,6 +1259,8 @@ void printHelp(){
 	cout << "<     - decrease volume radius" << endl;
 	cout << "+     - increase volume tex size" << endl;
 	cout << "-     - decrease volume tex size" << endl;
+	cout << "k     - save volume (with mip levels) to volume.dds" << endl;
+	cout << "m     - save the volume surface to volume.obj" << endl;
 	cout << "]     - increase noise power index" << endl;
 	cout << "[     - decrease noise power index" << endl;
 	cout << endl;
@@ -559,7 +1270,20 @@ void printHelp(){
 	cout << "z     - toggle fill mode" << endl;
 	cout << "x     - toggle xray mode" << endl;
 	cout << "c     - toggle color mode" << endl;
-	cout << "space - toggle volume / back buffers" << endl;
+	cout << "b     - toggle analytic ray exit / backface pass" << endl;
+	cout << "o     - toggle occupancy proxy geometry" << endl;
+	cout << "l     - toggle gradient shading" << endl;
+	cout << "t     - toggle pre-integrated transfer function" << endl;
+	cout << "d     - toggle distance field empty space skipping" << endl;
+	cout << "g     - toggle volume level of detail" << endl;
+	cout << "j     - toggle virtual volume (bricks generated, or read from the brick file, on demand)" << endl;
+	cout << "n     - toggle animated noise (frames generated ahead in the background)" << endl;
+	cout << "p     - toggle time series playback (--series directory)" << endl;
+	cout << ", .   - time series frame rate down / up" << endl;
+	cout << "f     - toggle frame server (frames in shared memory " << FRAMESERVER_NAME << ", see frameclient)" << endl;
+	cout << "0     - raise transfer function threshold" << endl;
+	cout << "9     - lower transfer function threshold" << endl;
+	cout << "space - toggle volume / back buffers (backface pass only)" << endl;
 	cout << endl;
 	cout << "v     - toggle verbosity mode" << endl;
 	cout << "s     - prints status message" << endl;
@@ -579,6 +1303,48 @@ void printStatus(){
 	cout << "fill mode         = " << ((fill_mode)?"on":"off") << endl;
 	cout << "xray mode         = " << ((xray_mode)?"on":"off") << endl;
 	cout << "color mode        = " << ((color_mode)?"on":"off") << endl;
+	cout << "analytic mode     = " << ((analytic_mode)?"on":"off") << endl;
+	cout << "shading mode      = " << ((shading_mode)?"on":"off") << endl;
+	cout << "pre-integration   = " << ((preint_mode)?"on":"off") << endl;
+	cout << "tf threshold      = " << tf_threshold << endl;
+	cout << "sphere tracing    = " << ((sdf_mode)?"on":"off") << endl;
+	cout << "level of detail   = " << ((lod_mode)?"on":"off") << endl;
+	cout << "virtual volume    = " << ((virtual_mode)?"on":"off") << endl;
+	if(virtual_mode){
+		virtualvolume::Stats vs = virtualvolume::stats();
+		cout << "  resident bricks = " << vs.resident << " / " << VIRTUAL_CAPACITY << endl;
+		cout << "  pending bricks  = " << vs.pending << endl;
+		cout << "  empty / rejected= " << vs.empty << " / " << vs.rejected << endl;
+		cout << "  generated       = " << vs.generated << ", evicted " << vs.evicted << endl;
+	}
+	cout << "animated noise    = " << ((noise_animation_mode)?"on":"off") << endl;
+	if(noise_animation_mode){
+		framering::Stats fs = framering::stats();
+		cout << "  generated       = " << fs.produced << " frames, " << fs.framesPerSecond << " frames/s sustained" << endl;
+		cout << "  ring            = " << fs.ready << " / " << fs.capacity << " ready" << endl;
+		cout << "  shown / stalls  = " << fs.consumed << " / " << fs.stalls << endl;
+	}
+	cout << "frame server      = " << ((frameserver_mode)?"on":"off") << endl;
+	if(frameserver_mode){
+		frameserver::Stats fs = frameserver::stats();
+		cout << "  published       = " << fs.published << " frames, " << fs.framesPerSecond << " frames/s" << endl;
+	}
+	if(timeseries::isOpen()){
+		timeseries::Stats ts = timeseries::stats();
+		cout << "time series       = " << ((series_mode)?"on":"off") << ", " << ts.files << " files" << endl;
+		cout << "  frame rate      = " << ts.shownFps << " / " << ts.targetFps << " frames/s" << endl;
+		cout << "  dropped / late  = " << ts.dropped << " / " << ts.late << " of " << ts.shown + ts.dropped << endl;
+		cout << "  queue           = " << ts.queued << " / " << ts.capacity << " decoded, " << ts.readMBps << " MB/s read" << endl;
+	}
+	if(brickstore::isOpen()){
+		brickstore::Stats bs = brickstore::stats();
+		cout << "brick file        = " << brickstore::size() << "^3, " << bs.bricks << " bricks, " << bs.emptyBricks << " empty" << endl;
+		cout << "  host cache      = " << bs.residentBricks << " bricks, " << (bs.residentBytes >> 20) << " / " << (bs.budget >> 20) << " MB" << endl;
+		cout << "  hits / misses   = " << bs.hits << " / " << bs.misses << ", evicted " << bs.evicted << endl;
+		cout << "  prefetched      = " << bs.prefetched << ", " << bs.prefetchHits << " of them used" << endl;
+		cout << "  read from disk  = " << (long)(bs.bytesRead / (1 << 20)) << " MB" << endl;
+	}
+	cout << "proxy mode        = " << ((proxy_mode)?"on":"off") << " (" << proxy_boxes.size() << " boxes)" << endl;
 	cout << "verbose mode      = " << ((verbose)?"on":"off") << endl;
 	cout << "--------------------" << endl << endl;
 }
@@ -641,7 +1407,8 @@ void setupControls(){
 			volume_tex_size = 4;
 			cout << "Minimum volume tex size!"<<endl;
 		}
-		else{
+		// as '=' : the volume follows the size only with autoupdate on
+		else if (autoupdate_mode && !shrink_volumetexture()){
 			update_volumetexture();
 		}
 		printStatus();
@@ -659,6 +1426,14 @@ void setupControls(){
 		printStatus();
 	});
 
+	controls::onKeyRelease('k', [](){
+		save_volumetexture();
+	});
+
+	controls::onKeyRelease('m', [](){
+		save_isosurface();
+	});
+
 	controls::onKeyRelease('/', [](){
 		animation_mode = !animation_mode;
 	});
@@ -693,6 +1468,79 @@ void setupControls(){
 		printStatus();
 	});
 
+	controls::onKeyRelease('b', [](){
+		analytic_mode = !analytic_mode;
+		printStatus();
+	});
+
+	controls::onKeyRelease('o', [](){
+		proxy_mode = !proxy_mode;
+		printStatus();
+	});
+
+	controls::onKeyRelease('l', [](){
+		shading_mode = !shading_mode;
+		upload_gradienttexture();
+		printStatus();
+	});
+
+	controls::onKeyRelease('t', [](){
+		preint_mode = !preint_mode;
+		printStatus();
+	});
+
+	controls::onKeyRelease('d', [](){
+		sdf_mode = !sdf_mode;
+		upload_distancetexture();
+		printStatus();
+	});
+
+	controls::onKeyRelease('g', [](){
+		lod_mode = !lod_mode;
+		set_volume_filter();
+		printStatus();
+	});
+
+	controls::onKeyRelease('j', [](){
+		toggle_virtualvolume();
+		printStatus();
+	});
+
+	controls::onKeyRelease('n', [](){
+		toggle_noise_animation();
+		printStatus();
+	});
+
+	controls::onKeyRelease('f', [](){
+		toggle_frameserver();
+		printStatus();
+	});
+
+	controls::onKeyRelease('p', [](){
+		toggle_series();
+		printStatus();
+	});
+
+	controls::onKeyRelease(',', [](){
+		timeseries::setFrameRate(max(1.0, timeseries::stats().targetFps / 1.25));
+		printStatus();
+	});
+
+	controls::onKeyRelease('.', [](){
+		timeseries::setFrameRate(min(240.0, timeseries::stats().targetFps * 1.25));
+		printStatus();
+	});
+
+	controls::onKeyRelease('0', [](){
+		set_tf_threshold(tf_threshold + 8);
+		printStatus();
+	});
+
+	controls::onKeyRelease('9', [](){
+		set_tf_threshold(tf_threshold - 8);
+		printStatus();
+	});
+
 	controls::onKeyRelease('v', [](){
 		verbose = !verbose;
 		printStatus();
@@ -751,9 +1599,287 @@ void setupControls(){
 
 }
 
+// time of the scalar sampler, in ns per sample, on the volume stored in
+// Layout
+template<class Layout>
+double time_sampler_layout(const unsigned char * data, int n, const vector<float> & s, const vector<float> & t, const vector<float> & r)
+{
+	LayoutVolume<Layout> volume;
+	prepareSamplerVolume(data, n, volume);
+	vector<float> out(s.size());
+	auto start = chrono::steady_clock::now();
+	for (size_t i = 0; i < out.size(); i++)
+		out[i] = sampleVolume(volume, s[i], t[i], r[i]);
+	return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / out.size();
+}
+
+// the memory layouts of an n^3 volume, on rays in every direction : along
+// r the linear layout touches a new cache line every sample, the bricked
+// ones do not
+void bench_layouts(const unsigned char * data, int n)
+{
+	const int rays = 4096, steps = n;
+	vector<float> s((size_t)rays*steps), t((size_t)rays*steps), r((size_t)rays*steps);
+	srand(1);
+	for (int i = 0; i < rays; i++){
+		glm::vec3 from(rand(), rand(), rand());
+		glm::vec3 dir(rand() - RAND_MAX/2, rand() - RAND_MAX/2, rand() - RAND_MAX/2);
+		from /= (float)RAND_MAX;
+		dir = glm::normalize(dir) / (float)n;
+		for (int j = 0; j < steps; j++){
+			glm::vec3 x = glm::fract(from + dir * (float)j);
+			s[(size_t)i*steps+j] = x.x; t[(size_t)i*steps+j] = x.y; r[(size_t)i*steps+j] = x.z;
+		}
+	}
+	cout << n << "^3, scalar sampler, linear : "     << time_sampler_layout<LinearLayout>(data, n, s, t, r)     << " ns per sample" << endl;
+	cout << n << "^3, scalar sampler, 4^3 bricks : " << time_sampler_layout<BrickedLayout<4> >(data, n, s, t, r) << " ns per sample" << endl;
+	cout << n << "^3, scalar sampler, 8^3 bricks : " << time_sampler_layout<BrickedLayout<8> >(data, n, s, t, r) << " ns per sample" << endl;
+}
+
+// the render modes the CPU renderer follows, from the *_mode globals
+unsigned int cpu_ray_modes()
+{
+	return (adaptive_mode ? CPU_MODE_ADAPTIVE : 0) | (fill_mode  ? CPU_MODE_FILL  : 0)
+	     | (xray_mode     ? CPU_MODE_XRAY     : 0) | (color_mode ? CPU_MODE_COLOR : 0);
+}
+
+string cpu_ray_modes_name(unsigned int modes)
+{
+	string name;
+	const char * names[] = {"adaptive", "fill", "xray", "color"};
+	for (int i = 0; i < 4; i++)
+		if (modes & (1 << i))
+			name += (name.empty() ? "" : "+") + string(names[i]);
+	return name.empty() ? "none" : name;
+}
+
+// renders the generated volume on the CPU, without a window, with every
+// ray marcher the processor supports, and reports their speed
+int cpu_benchmark(int frames)
+{
+	generate_volume();
+	const TextureLevel & top = volume_pyramid.levels[0];
+	SamplerVolume volume;
+	prepareSamplerVolume(&volume_pyramid.storage[top.offset], top.width, volume);
+
+	// the view display() starts with
+	glm::mat4 mvp = glm::perspective(60.0f, 1.0f, 0.01f, 400.0f)
+	              * glm::translate(glm::mat4(1.0f), glm::vec3(0, 0, -2.25f + _xdistance))
+	              * glm::translate(glm::mat4(1.0f), glm::vec3(-0.5f));
+	CpuRayOptions options = {stepsize, cpu_ray_modes(), false};
+
+	vector<unsigned char> reference(WINDOW_SIZE*WINDOW_SIZE*4), image(WINDOW_SIZE*WINDOW_SIZE*4);
+	double scalar_time = 0;
+	CpuRayPath paths[] = {CPU_RAY_SCALAR, CPU_RAY_AVX2, CPU_RAY_AVX512};
+	for (CpuRayPath path : paths){
+		if (!cpuRayPathSupported(path)){
+			cout << cpuRayPathName(path) << " : not supported" << endl;
+			continue;
+		}
+		vector<unsigned char> & out = path == CPU_RAY_SCALAR ? reference : image;
+		renderVolumeCPU(volume, mvp, options, WINDOW_SIZE, WINDOW_SIZE, &out[0], path);
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++)
+			renderVolumeCPU(volume, mvp, options, WINDOW_SIZE, WINDOW_SIZE, &out[0], path);
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+		if (path == CPU_RAY_SCALAR) scalar_time = ms;
+
+		int difference = 0;
+		for (size_t i = 0; i < out.size(); i++)
+			difference = max(difference, abs((int)out[i] - (int)reference[i]));
+		cout << cpuRayPathName(path) << " : " << ms << " ms per frame, "
+		     << WINDOW_SIZE*WINDOW_SIZE / (ms * 1000) << " Mpixel/s, "
+		     << scalar_time / ms << "x scalar, max difference " << difference << endl;
+	}
+
+	// the volume interleaved over the NUMA nodes, as above, against one
+	// replica per node
+	cout << numaNodes() << " NUMA node" << (numaNodes() > 1 ? "s" : "") << endl;
+	if (numaNodes() > 1){
+		vector<SamplerVolume> replicas;
+		replicateVolume(volume, replicas);
+		renderVolumeCPU(replicas, mvp, options, WINDOW_SIZE, WINDOW_SIZE, &image[0]);
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++)
+			renderVolumeCPU(replicas, mvp, options, WINDOW_SIZE, WINDOW_SIZE, &image[0]);
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+		cout << "replicated per node : " << ms << " ms per frame" << endl;
+	}
+
+	// sort-last : bricks rendered by forked processes, binary swap
+	// composited, against the single process render on the same path.
+	// On the starting view and on one turned off the axes, where rays
+	// cross the bricks in every order. The images differ by the error of
+	// the compositing operator, bounded in sortlast.hpp.
+	CpuRayOptions composable = {stepsize, options.modes & ~CPU_MODE_XRAY, false};
+	glm::mat4 turned = mvp * glm::translate(glm::mat4(1.0f), glm::vec3(0.5f))
+	                 * glm::rotate(glm::mat4(1.0f), 30.0f, glm::vec3(1, 1, 0))
+	                 * glm::translate(glm::mat4(1.0f), glm::vec3(-0.5f));
+	glm::mat4 views[] = {mvp, turned};
+	const char * view_names[] = {"starting view", "turned view"};
+	for (int view = 0; view < 2; view++){
+		renderVolumeCPU(volume, views[view], composable, WINDOW_SIZE, WINDOW_SIZE, &reference[0]);
+		for (int processes = 2; processes <= max(2, parallel_threads()) && processes <= 16; processes *= 2){
+			sortlast::Stats stats = {};
+			double render = 0, composite = 0;
+			bool ok = true;
+			auto start = chrono::steady_clock::now();
+			for (int i = 0; i < frames && ok; i++){
+				ok = sortlast::renderVolumeSortLast(volume, views[view], composable, WINDOW_SIZE, WINDOW_SIZE, &image[0], processes, &stats);
+				render += stats.renderSeconds;
+				composite += stats.compositeSeconds;
+			}
+			if (!ok){
+				cout << "sort-last, " << processes << " processes : failed" << endl;
+				break;
+			}
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+			int difference = 0;
+			double total = 0;
+			for (size_t i = 0; i < image.size(); i += 4)
+				for (int c = 0; c < 3; c++){
+					int d = abs((int)image[i+c] - (int)reference[i+c]);
+					difference = max(difference, d);
+					total += d;
+				}
+			cout << "sort-last, " << view_names[view] << ", " << processes << " processes : " << ms << " ms per frame ("
+			     << render * 1000 / frames << " rendering, " << composite * 1000 / frames << " compositing), "
+			     << stats.bytesSent / (1 << 20) << " MB sent, color difference " << difference << " max, "
+			     << total / (image.size() / 4 * 3) << " mean" << endl;
+		}
+	}
+
+	// every combination of modes on the widest path, with the kernel
+	// compiled for it and with the one testing the modes at every sample.
+	// Where the path has no kernel of its own for the modes both are the
+	// same one : it is timed once, and no ratio is given.
+	CpuRayPath widest = renderVolumeCPU(volume, mvp, options, WINDOW_SIZE, WINDOW_SIZE, &image[0]);
+	for (unsigned int modes = 0; modes < CPU_MODE_COUNT; modes++){
+		double time[2];
+		bool compiled = cpuRayModesCompiled(widest, modes);
+		for (int runtime = 0; runtime < (compiled ? 2 : 1); runtime++){
+			CpuRayOptions mode_options = {stepsize, modes, runtime != 0};
+			renderVolumeCPU(volume, mvp, mode_options, WINDOW_SIZE, WINDOW_SIZE, &image[0]);
+			auto start = chrono::steady_clock::now();
+			for (int i = 0; i < frames; i++)
+				renderVolumeCPU(volume, mvp, mode_options, WINDOW_SIZE, WINDOW_SIZE, &image[0]);
+			time[runtime] = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+		}
+		if (compiled)
+			cout << "modes " << cpu_ray_modes_name(modes) << " : " << time[0] << " ms per frame, "
+			     << time[1] << " ms testing the modes per sample, " << time[1] / time[0] << "x" << endl;
+		else
+			cout << "modes " << cpu_ray_modes_name(modes) << " : " << time[0] << " ms per frame, runtime" << endl;
+	}
+
+	// the layouts on the volume, which fits in the caches, and on the
+	// volume tiled into one larger than most last level caches, where
+	// the cache lines the bricked layouts save come from memory
+	const unsigned char * data = &volume_pyramid.storage[top.offset];
+	bench_layouts(data, top.width);
+	int n = top.width, large = LAYOUT_BENCH_SIZE;
+	vector<unsigned char> tiled((size_t)large*large*large);
+	parallel_for(0, large, [&](int first, int last){
+		for (int z = first; z < last; z++)
+		for (int y = 0; y < large; y++)
+		for (int x = 0; x < large; x++)
+			tiled[((size_t)z*large + y)*large + x] = data[((size_t)(z % n)*n + y % n)*n + x % n];
+	});
+	bench_layouts(&tiled[0], large);
+	return 0;
+}
+
+// checks every CPU sampler path against the reference on the generated
+// volume
+int validate_sampler()
+{
+	generate_volume();
+	const TextureLevel & top = volume_pyramid.levels[0];
+	size_t mismatches = validateSampler(&volume_pyramid.storage[top.offset], top.width, 1000000);
+	SamplerPath paths[] = {SAMPLER_SCALAR, SAMPLER_SSE, SAMPLER_AVX2, SAMPLER_AVX512};
+	for (SamplerPath path : paths)
+		cout << samplerPathName(path) << " : " << (samplerPathSupported(path) ? "checked" : "not supported") << endl;
+	cout << mismatches << " samples differ from the reference" << endl;
+	return mismatches ? 1 : 0;
+}
+
+// checks that the isosurface extraction gives closed manifold meshes
+int validate_isosurface()
+{
+	size_t bad = validateIsosurface(20, 20);
+	cout << bad << " edges not shared by exactly two triangles" << endl;
+	return bad ? 1 : 0;
+}
+
+// writes the noise volume, size^3, as a brick file
+int write_bricks(const string & path, int size)
+{
+	cout << "writing " << size << "^3 bricks to " << path << endl;
+	NoiseParams params = noise_params();
+	bool ok = brickstore::write(path, size, VIRTUAL_BRICK_SIZE, [size, params](int x, int y, int z, int brick, unsigned char * out){
+		int apron = brick + 2;
+		for (int i = 0; i < apron; i++)
+		for (int j = 0; j < apron; j++)
+		for (int k = 0; k < apron; k++)
+			*out++ = volume_voxel(params, x+i, y+j, z+k, size);
+	});
+	if (!ok)
+		cout << "could not write " << path << endl;
+	return ok ? 0 : 1;
+}
+
+// stops the worker threads before the process goes : threads still
+// joinable when their objects are destroyed at exit abort the process
+void shutdown_workers()
+{
+	texturecache::shutdown();
+	virtualvolume::stop();
+	// after the virtual volume : its workers read the brick file
+	brickstore::close();
+	framering::shutdown();
+	timeseries::close();
+	// or the segment stays in /dev/shm
+	frameserver::close();
+}
+
+// raycast [volume.dds]                  : interactive
+// raycast --bricks file [cache MB]      : interactive, paging a brick file
+// raycast --series directory [fps]      : interactive, playing the .dds files of directory
+// raycast --write-bricks file [size]    : writes the noise as a brick file
+// raycast --cpu-bench [frames]          : headless CPU rendering benchmark
+// raycast --validate-sampler            : bit exactness of the CPU sampler paths
+// raycast --validate-isosurface         : the isosurface meshes are closed manifolds
 int main(int argc, char* argv[])
 {
+	// GLUT leaves glutMainLoop through exit()
+	atexit(shutdown_workers);
+
+	if (argc > 1 && string(argv[1]) == "--cpu-bench")
+		return cpu_benchmark(argc > 2 ? max(1, atoi(argv[2])) : 10);
+	if (argc > 1 && string(argv[1]) == "--validate-sampler")
+		return validate_sampler();
+	if (argc > 1 && string(argv[1]) == "--validate-isosurface")
+		return validate_isosurface();
+	if (argc > 2 && string(argv[1]) == "--write-bricks")
+		return write_bricks(argv[2], argc > 3 ? max(VIRTUAL_BRICK_SIZE, atoi(argv[3])) : 2048);
+	if (argc > 2 && string(argv[1]) == "--bricks"){
+		size_t budget = (size_t)(argc > 3 ? max(1, atoi(argv[3])) : BRICK_CACHE_MB) << 20;
+		if (!brickstore::open(argv[2], budget)){
+			cout << "could not open brick file " << argv[2] << endl;
+			return 1;
+		}
+	}
+	if (argc > 2 && string(argv[1]) == "--series"){
+		double fps = argc > 3 ? max(1.0, atof(argv[3])) : SERIES_FPS;
+		if (!timeseries::open(argv[2], fps, SERIES_QUEUE, SERIES_READAHEAD)){
+			cout << "no .dds volume in " << argv[2] << endl;
+			return 1;
+		}
+	}
+
 	glutInit(&argc,argv);
+	if (argc > 1 && !brickstore::isOpen() && !timeseries::isOpen())
+		volume_path = argv[1];
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
 	glutCreateWindow("super duper raycasting");
 	glutReshapeWindow(WINDOW_SIZE,WINDOW_SIZE);
@@ -765,6 +1891,10 @@ int main(int argc, char* argv[])
 
 	setupControls();
 	init();
+	if (brickstore::isOpen())
+		toggle_virtualvolume();
+	if (timeseries::isOpen())
+		toggle_series();
 
 	printStatus();
 	printHelp();